@@ -0,0 +1,104 @@
+/**********************************************************************
+ * Copyright (c) 2020-2021
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#ifndef __BITMAP_H__
+#define __BITMAP_H__
+
+#define BITS_PER_LONG	(sizeof(unsigned long) * 8)
+#define BITS_TO_LONGS(nr)	(((nr) + BITS_PER_LONG - 1) / BITS_PER_LONG)
+
+static inline void set_bit(unsigned long nr, unsigned long *map)
+{
+	map[nr / BITS_PER_LONG] |= 1UL << (nr % BITS_PER_LONG);
+}
+
+static inline void clear_bit(unsigned long nr, unsigned long *map)
+{
+	map[nr / BITS_PER_LONG] &= ~(1UL << (nr % BITS_PER_LONG));
+}
+
+static inline bool test_bit(unsigned long nr, const unsigned long *map)
+{
+	return (map[nr / BITS_PER_LONG] >> (nr % BITS_PER_LONG)) & 1;
+}
+
+/* The lowest set bit of @word, which should not be 0 */
+static inline unsigned long __word_first_bit(unsigned long word)
+{
+	unsigned long bit = 0;
+
+	while (!(word & 1)) {
+		word >>= 1;
+		bit++;
+	}
+	return bit;
+}
+
+/**
+ * find_next_bit(@map, @size, @offset)
+ *
+ * DESCRIPTION
+ *   Find the first set bit in @map at or after @offset, looking at a word of
+ *   bits at a time.
+ *
+ * RETURN
+ *   The bit number, or @size if no bit is set in [@offset, @size)
+ */
+static inline unsigned long find_next_bit(const unsigned long *map,
+		unsigned long size, unsigned long offset)
+{
+	unsigned long i = offset / BITS_PER_LONG;
+	unsigned long word;
+
+	if (offset >= size) return size;
+
+	word = map[i] & (~0UL << (offset % BITS_PER_LONG));
+	while (!word) {
+		if (++i >= BITS_TO_LONGS(size)) return size;
+		word = map[i];
+	}
+	offset = i * BITS_PER_LONG + __word_first_bit(word);
+
+	return offset < size ? offset : size;
+}
+
+/**
+ * find_next_zero_bit(@map, @size, @offset)
+ *
+ * DESCRIPTION
+ *   Same as find_next_bit() but look for a cleared bit.
+ */
+static inline unsigned long find_next_zero_bit(const unsigned long *map,
+		unsigned long size, unsigned long offset)
+{
+	unsigned long i = offset / BITS_PER_LONG;
+	unsigned long word;
+
+	if (offset >= size) return size;
+
+	word = ~map[i] & (~0UL << (offset % BITS_PER_LONG));
+	while (!word) {
+		if (++i >= BITS_TO_LONGS(size)) return size;
+		word = ~map[i];
+	}
+	offset = i * BITS_PER_LONG + __word_first_bit(word);
+
+	return offset < size ? offset : size;
+}
+
+#define find_first_bit(map, size)	find_next_bit((map), (size), 0)
+#define find_first_zero_bit(map, size)	find_next_zero_bit((map), (size), 0)
+
+#endif
@@ -0,0 +1,565 @@
+/**********************************************************************
+ * Copyright (c) 2020-2021
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <sys/mman.h>
+
+#include "types.h"
+#include "list_head.h"
+#include "bitmap.h"
+#include "vm.h"
+#include "frame.h"
+
+/**
+ * The number of physical page frames of the system
+ */
+unsigned int nr_pageframes = NR_PAGEFRAMES;
+unsigned int nr_free_frames = 0;
+unsigned int max_frames_in_use = 0;
+
+/**
+ * Map count for each page frame
+ */
+unsigned int *mapcounts = NULL;
+
+/**
+ * Free page frames. A bit is set if the page frame is not mapped at all,
+ * so the smallest free PFN can be found a word at a time.
+ */
+static unsigned long *free_frames = NULL;
+
+/**
+ * Binary buddy allocator. Free page frames are grouped into blocks of
+ * (1 << order) page frames aligned to their size, and a block is merged with
+ * its buddy whenever both of them are free. The first page frame of each free
+ * block records the order of the block in @buddy_orders, and the blocks of
+ * each order are chained through @buddy_next and @buddy_prev, of which the
+ * index (@nr_pageframes + order) is the list head. @free_frames is kept in
+ * sync, so the smallest free PFN is still found from the bitmap.
+ */
+#define BUDDY_NONE	0xff
+
+unsigned int nr_buddy_orders = 0;
+static unsigned char *buddy_orders = NULL;
+static unsigned int *buddy_next = NULL;
+static unsigned int *buddy_prev = NULL;
+static unsigned long *nr_buddy_blocks = NULL;
+
+unsigned long nr_buddy_allocs = 0;
+unsigned long nr_buddy_frees = 0;
+unsigned long nr_buddy_steps = 0;
+
+/**
+ * Reverse mapping for each page frame
+ */
+struct hlist_head *rmaps = NULL;
+
+/**
+ * Page replacement. In-use page frames are chained in the order they are
+ * mapped through @lru_next and @lru_prev, of which the index
+ * @nr_pageframes is the list head. FIFO picks the victim from the head,
+ * CLOCK sweeps the list with @clock_hand giving referenced frames a second
+ * chance, and LRU approximates the recency with the aging counters in
+ * @ages. Page frames in @pinned_frames are never picked.
+ */
+enum reclaim_policy reclaim_policy = RECLAIM_NONE;
+
+static unsigned int *lru_next = NULL;
+static unsigned int *lru_prev = NULL;
+static unsigned char *ages = NULL;
+static unsigned long *pinned_frames = NULL;
+static unsigned int clock_hand;
+
+/**
+ * Contents of page frames. The simulator does not keep the data of pages,
+ * but tags each page frame with the ID of the data it holds so that the data
+ * written to and read from the swap can be generated and verified.
+ */
+unsigned long *frame_contents = NULL;
+static unsigned long nr_contents = 0;
+
+#define HUGE_PAGE_SIZE	(2UL << 20)
+
+/**
+ * Allocate zero-filled frame metadata of @size bytes. Large metadata is
+ * backed by huge pages if possible so that walking it does not thrash the
+ * TLB of the host.
+ */
+static void *__alloc_frame_metadata(size_t size)
+{
+	void *p;
+
+	if (size >= HUGE_PAGE_SIZE) {
+		size_t huge_size = (size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+
+		p = mmap(NULL, huge_size, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (p != MAP_FAILED) return p;
+	}
+
+	p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED) return NULL;
+
+	if (size >= HUGE_PAGE_SIZE) madvise(p, size, MADV_HUGEPAGE);
+
+	return p;
+}
+
+static void __buddy_add(unsigned int pfn, unsigned int order)
+{
+	unsigned int head = nr_pageframes + order;
+	unsigned int tail = buddy_prev[head];
+
+	buddy_next[pfn] = head;
+	buddy_prev[pfn] = tail;
+	buddy_next[tail] = pfn;
+	buddy_prev[head] = pfn;
+
+	buddy_orders[pfn] = order;
+	nr_buddy_blocks[order]++;
+}
+
+static void __buddy_del(unsigned int pfn)
+{
+	buddy_next[buddy_prev[pfn]] = buddy_next[pfn];
+	buddy_prev[buddy_next[pfn]] = buddy_prev[pfn];
+
+	nr_buddy_blocks[buddy_orders[pfn]]--;
+	buddy_orders[pfn] = BUDDY_NONE;
+}
+
+/**
+ * Put the page frame @pfn back, merging its block with the buddy as long as
+ * the buddy is free as a whole.
+ */
+static void __buddy_free(unsigned int pfn)
+{
+	unsigned int order = 0;
+
+	set_bit(pfn, free_frames);
+
+	for (; order < nr_buddy_orders - 1; order++) {
+		unsigned int buddy = pfn ^ (1U << order);
+
+		if (buddy >= nr_pageframes || buddy_orders[buddy] != order) break;
+
+		__buddy_del(buddy);
+		pfn &= buddy;
+		nr_buddy_steps++;
+	}
+	__buddy_add(pfn, order);
+	nr_buddy_steps++;
+}
+
+/**
+ * Take the free page frame @pfn out of its free block, splitting the block
+ * into the halves that do not contain @pfn.
+ */
+static void __buddy_take(unsigned int pfn)
+{
+	unsigned int head = pfn;
+	unsigned int order = 0;
+
+	for (; buddy_orders[head] != order; order++) {
+		head = pfn & ~((2U << order) - 1);
+		assert(order < nr_buddy_orders);
+	}
+	__buddy_del(head);
+	nr_buddy_steps++;
+
+	while (order--) {
+		unsigned int half = head + (1U << order);
+
+		if (pfn >= half) {
+			__buddy_add(head, order);
+			head = half;
+		} else {
+			__buddy_add(half, order);
+		}
+		nr_buddy_steps++;
+	}
+	clear_bit(pfn, free_frames);
+}
+
+static int __init_buddy(void)
+{
+	nr_buddy_orders = 1;
+	while ((2UL << (nr_buddy_orders - 1)) <= nr_pageframes) nr_buddy_orders++;
+
+	buddy_orders = __alloc_frame_metadata(nr_pageframes);
+	buddy_next = __alloc_frame_metadata(
+			sizeof(*buddy_next) * (nr_pageframes + nr_buddy_orders));
+	buddy_prev = __alloc_frame_metadata(
+			sizeof(*buddy_prev) * (nr_pageframes + nr_buddy_orders));
+	nr_buddy_blocks = calloc(nr_buddy_orders, sizeof(*nr_buddy_blocks));
+	if (!buddy_orders || !buddy_next || !buddy_prev || !nr_buddy_blocks) {
+		return -1;
+	}
+
+	memset(buddy_orders, BUDDY_NONE, nr_pageframes);
+	for (unsigned int order = 0; order < nr_buddy_orders; order++) {
+		unsigned int head = nr_pageframes + order;
+
+		buddy_next[head] = buddy_prev[head] = head;
+	}
+
+	/* Carve the page frames into the largest aligned blocks */
+	for (unsigned int pfn = 0; pfn < nr_pageframes; ) {
+		unsigned int order = nr_buddy_orders - 1;
+
+		while ((pfn & ((1U << order) - 1)) || pfn + (1U << order) > nr_pageframes) {
+			order--;
+		}
+		__buddy_add(pfn, order);
+		pfn += 1U << order;
+	}
+	return 0;
+}
+
+int init_frames(void)
+{
+	if (!nr_pageframes) {
+		fprintf(stderr, "The system needs at least one page frame\n");
+		return -1;
+	}
+	if (nr_pageframes - 1 > PTE_MAX_PFN) {
+		fprintf(stderr, "PTEs can map up to %u page frames\n", PTE_MAX_PFN + 1);
+		return -1;
+	}
+
+	mapcounts = __alloc_frame_metadata(sizeof(*mapcounts) * nr_pageframes);
+	free_frames = __alloc_frame_metadata(
+			sizeof(*free_frames) * BITS_TO_LONGS(nr_pageframes));
+	rmaps = __alloc_frame_metadata(sizeof(*rmaps) * nr_pageframes);
+	pinned_frames = __alloc_frame_metadata(
+			sizeof(*pinned_frames) * BITS_TO_LONGS(nr_pageframes));
+	if (!mapcounts || !free_frames || !rmaps || !pinned_frames) {
+		fprintf(stderr, "Unable to allocate metadata for %u page frames\n",
+				nr_pageframes);
+		return -1;
+	}
+
+	for (unsigned int i = 0; i < nr_pageframes / BITS_PER_LONG; i++) {
+		free_frames[i] = ~0UL;
+	}
+	for (unsigned int pfn = nr_pageframes & ~(BITS_PER_LONG - 1);
+			pfn < nr_pageframes; pfn++) {
+		set_bit(pfn, free_frames);
+	}
+	nr_free_frames = nr_pageframes;
+
+	if (__init_buddy()) {
+		fprintf(stderr, "Unable to allocate the buddy allocator\n");
+		return -1;
+	}
+
+	if (reclaim_policy != RECLAIM_NONE) {
+		lru_next = __alloc_frame_metadata(sizeof(*lru_next) * (nr_pageframes + 1));
+		lru_prev = __alloc_frame_metadata(sizeof(*lru_prev) * (nr_pageframes + 1));
+		ages = __alloc_frame_metadata(nr_pageframes);
+		frame_contents = __alloc_frame_metadata(
+				sizeof(*frame_contents) * nr_pageframes);
+		if (!lru_next || !lru_prev || !ages || !frame_contents) {
+			fprintf(stderr, "Unable to allocate metadata for page replacement\n");
+			return -1;
+		}
+		lru_next[nr_pageframes] = lru_prev[nr_pageframes] = nr_pageframes;
+		clock_hand = nr_pageframes;
+	}
+
+	return 0;
+}
+
+int add_rmap(unsigned int pfn, struct process *p, unsigned long vpn)
+{
+	struct rmap *r = malloc(sizeof(*r));
+
+	if (!r) return -1;
+
+	r->process = p;
+	r->vpn = vpn;
+	hlist_add_head(&r->hnode, &rmaps[pfn]);
+	return 0;
+}
+
+void remove_rmap(unsigned int pfn, struct process *p, unsigned long vpn)
+{
+	struct rmap *r;
+
+	hlist_for_each_entry(r, &rmaps[pfn], hnode) {
+		if (r->process == p && r->vpn == vpn) {
+			hlist_del(&r->hnode);
+			free(r);
+			return;
+		}
+	}
+	assert(!"No reverse mapping to remove");
+}
+
+int set_reclaim_policy(const char *name)
+{
+	if (strcmp(name, "fifo") == 0) {
+		reclaim_policy = RECLAIM_FIFO;
+	} else if (strcmp(name, "clock") == 0) {
+		reclaim_policy = RECLAIM_CLOCK;
+	} else if (strcmp(name, "lru") == 0) {
+		reclaim_policy = RECLAIM_LRU;
+	} else {
+		fprintf(stderr, "Unknown page replacement policy %s\n", name);
+		return -1;
+	}
+	return 0;
+}
+
+static void __lru_add(unsigned int pfn)
+{
+	unsigned int head = nr_pageframes;
+	unsigned int tail = lru_prev[head];
+
+	lru_next[pfn] = head;
+	lru_prev[pfn] = tail;
+	lru_next[tail] = pfn;
+	lru_prev[head] = pfn;
+
+	ages[pfn] = 0x80;
+}
+
+static void __lru_del(unsigned int pfn)
+{
+	if (clock_hand == pfn) clock_hand = lru_next[pfn];
+
+	lru_next[lru_prev[pfn]] = lru_next[pfn];
+	lru_prev[lru_next[pfn]] = lru_prev[pfn];
+}
+
+void init_frame_content(unsigned int pfn)
+{
+	if (frame_contents) frame_contents[pfn] = ++nr_contents;
+}
+
+void copy_frame_content(unsigned int to, unsigned int from)
+{
+	if (frame_contents) frame_contents[to] = frame_contents[from];
+}
+
+void pin_frame(unsigned int pfn)
+{
+	set_bit(pfn, pinned_frames);
+}
+
+void unpin_frame(unsigned int pfn)
+{
+	clear_bit(pfn, pinned_frames);
+}
+
+static unsigned int __select_fifo(void)
+{
+	unsigned int head = nr_pageframes;
+
+	for (unsigned int pfn = lru_next[head]; pfn != head; pfn = lru_next[pfn]) {
+		if (!test_bit(pfn, pinned_frames)) return pfn;
+	}
+	return -1;
+}
+
+static unsigned int __select_clock(void)
+{
+	unsigned int head = nr_pageframes;
+	unsigned int nr_scans = (nr_pageframes - nr_free_frames) * 2 + 1;
+
+	while (nr_scans--) {
+		unsigned int pfn;
+
+		if (clock_hand == head) clock_hand = lru_next[head];
+		if (clock_hand == head) break;
+
+		pfn = clock_hand;
+		clock_hand = lru_next[pfn];
+
+		if (test_bit(pfn, pinned_frames)) continue;
+		if (page_referenced(pfn)) continue;
+
+		return pfn;
+	}
+	return -1;
+}
+
+static unsigned int __select_lru(void)
+{
+	unsigned int head = nr_pageframes;
+	unsigned int victim = -1;
+
+	for (unsigned int pfn = lru_next[head]; pfn != head; pfn = lru_next[pfn]) {
+		ages[pfn] >>= 1;
+		if (page_referenced(pfn)) ages[pfn] |= 0x80;
+
+		if (test_bit(pfn, pinned_frames)) continue;
+		if (victim == -1 || ages[pfn] < ages[victim]) victim = pfn;
+	}
+	return victim;
+}
+
+unsigned int select_victim_frame(void)
+{
+	switch (reclaim_policy) {
+	case RECLAIM_FIFO:
+		return __select_fifo();
+	case RECLAIM_CLOCK:
+		return __select_clock();
+	case RECLAIM_LRU:
+		return __select_lru();
+	default:
+		return -1;
+	}
+}
+
+unsigned int get_free_frame(void)
+{
+	unsigned int pfn = find_first_bit(free_frames, nr_pageframes);
+
+	if (pfn == nr_pageframes) return -1;
+
+	return pfn;
+}
+
+unsigned int get_free_frames(unsigned int nr_frames)
+{
+	unsigned int order = order_of_frames(nr_frames);
+
+	/* The first block of the smallest order that fits */
+	for (; order < nr_buddy_orders; order++) {
+		unsigned int head = nr_pageframes + order;
+
+		if (buddy_next[head] != head) return buddy_next[head];
+	}
+	return -1;
+}
+
+unsigned int next_free_frame(unsigned int pfn)
+{
+	return find_next_bit(free_frames, nr_pageframes, pfn);
+}
+
+int largest_free_order(void)
+{
+	for (int order = nr_buddy_orders - 1; order >= 0; order--) {
+		if (nr_buddy_blocks[order]) return order;
+	}
+	return -1;
+}
+
+unsigned long nr_free_blocks(unsigned int order)
+{
+	return nr_buddy_blocks[order];
+}
+
+/* Count the free blocks of (1 << @order) page frames carved out of the larger ones */
+static unsigned long __nr_suitable_blocks(unsigned int order)
+{
+	unsigned long nr_blocks = 0;
+
+	for (unsigned int o = order; o < nr_buddy_orders; o++) {
+		nr_blocks += nr_buddy_blocks[o] << (o - order);
+	}
+	return nr_blocks;
+}
+
+int fragmentation_index(unsigned int order)
+{
+	unsigned long nr_blocks = 0;
+
+	for (unsigned int o = 0; o < nr_buddy_orders; o++) {
+		nr_blocks += nr_buddy_blocks[o];
+	}
+
+	if (!nr_blocks) return 0;
+	if (__nr_suitable_blocks(order)) return -1000;
+
+	return 1000 - (1000 + nr_free_frames * 1000UL / (1UL << order)) / nr_blocks;
+}
+
+unsigned int unusable_index(unsigned int order)
+{
+	if (!nr_free_frames) return 0;
+
+	return (nr_free_frames - (__nr_suitable_blocks(order) << order)) * 1000UL /
+			nr_free_frames;
+}
+
+unsigned int next_mapped_frame(unsigned int pfn)
+{
+	return find_next_zero_bit(free_frames, nr_pageframes, pfn);
+}
+
+void get_page(unsigned int pfn)
+{
+	if (mapcounts[pfn]++ == 0) {
+		__buddy_take(pfn);
+		nr_buddy_allocs++;
+		nr_free_frames--;
+
+		if (nr_pageframes - nr_free_frames > max_frames_in_use) {
+			max_frames_in_use = nr_pageframes - nr_free_frames;
+		}
+
+		if (lru_next) __lru_add(pfn);
+	}
+}
+
+bool frame_movable(unsigned int pfn)
+{
+	return mapcounts[pfn] && !test_bit(pfn, pinned_frames) && !hlist_empty(&rmaps[pfn]);
+}
+
+void move_frame(unsigned int to, unsigned int from)
+{
+	assert(!mapcounts[to] && mapcounts[from]);
+
+	__buddy_take(to);
+	__buddy_free(from);
+	nr_buddy_allocs++;
+	nr_buddy_frees++;
+
+	mapcounts[to] = mapcounts[from];
+	mapcounts[from] = 0;
+	hlist_move_list(&rmaps[from], &rmaps[to]);
+
+	/* Keep the place in the page replacement order */
+	if (lru_next) {
+		lru_next[to] = lru_next[from];
+		lru_prev[to] = lru_prev[from];
+		lru_next[lru_prev[from]] = to;
+		lru_prev[lru_next[from]] = to;
+		ages[to] = ages[from];
+
+		if (clock_hand == from) clock_hand = to;
+	}
+	copy_frame_content(to, from);
+}
+
+void put_page(unsigned int pfn)
+{
+	if (--mapcounts[pfn] == 0) {
+		__buddy_free(pfn);
+		nr_buddy_frees++;
+		nr_free_frames++;
+
+		if (lru_next) __lru_del(pfn);
+	}
+}
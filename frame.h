@@ -0,0 +1,283 @@
+/**********************************************************************
+ * Copyright (c) 2020-2021
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#ifndef __FRAME_H__
+#define __FRAME_H__
+
+#include "types.h"
+#include "list_head.h"
+
+struct process;
+
+/**
+ * The number of physical page frames, which can be set before init_frames()
+ */
+extern unsigned int nr_pageframes;
+extern unsigned int nr_free_frames;
+
+/* The high-water mark of the page frames in use */
+extern unsigned int max_frames_in_use;
+
+/**
+ * The number of mappings for each page frame
+ */
+extern unsigned int *mapcounts;
+
+/**
+ * init_frames()
+ *
+ * DESCRIPTION
+ *   Allocate the metadata for @nr_pageframes page frames, and mark all of
+ *   them free. Should be called before any page frame is handed out.
+ *
+ * RETURN
+ *   0 on success
+ *   -1 if unable to allocate the metadata
+ */
+int init_frames(void);
+
+/**
+ * get_free_frame()
+ *
+ * DESCRIPTION
+ *   Find the free page frame with the smallest PFN. The page frame is not
+ *   taken until it is mapped with get_page().
+ *
+ * RETURN
+ *   PFN of the free page frame
+ *   -1 if all page frames are in use
+ */
+unsigned int get_free_frame(void);
+
+/**
+ * get_free_frames(@nr_frames)
+ *
+ * DESCRIPTION
+ *   Find @nr_frames free page frames that are contiguous and aligned to
+ *   @nr_frames, which should be a power of 2. The page frames are taken from
+ *   the first of the smallest free buddy blocks that fit, without searching
+ *   the blocks of the order. Page frames are not reclaimed to make room,
+ *   and are not taken until mapped with get_page().
+ *
+ * RETURN
+ *   PFN of the first page frame
+ *   -1 if there is no such range
+ */
+unsigned int get_free_frames(unsigned int nr_frames);
+
+/* The smallest order of the buddy blocks holding @nr_frames page frames */
+static inline unsigned int order_of_frames(unsigned int nr_frames)
+{
+	unsigned int order = 0;
+
+	while ((1U << order) < nr_frames) order++;
+
+	return order;
+}
+
+/**
+ * Buddy allocator of page frames. Free page frames are kept in the blocks of
+ * (1 << order) page frames for @nr_buddy_orders orders, which are split and
+ * merged as page frames are taken and freed. @nr_buddy_steps counts the list
+ * and split/merge operations, which tells the latency of the allocator.
+ */
+extern unsigned int nr_buddy_orders;
+extern unsigned long nr_buddy_allocs;
+extern unsigned long nr_buddy_frees;
+extern unsigned long nr_buddy_steps;
+
+unsigned long nr_free_blocks(unsigned int order);
+
+/**
+ * fragmentation_index(@order)
+ *
+ * RETURN
+ *   The fragmentation index for allocating (1 << @order) page frames in
+ *   thousandths. It approaches 1000 when the allocation fails for the
+ *   fragmentation, and approaches 0 when it fails for the lack of memory.
+ *   -1000 if the allocation succeeds.
+ */
+int fragmentation_index(unsigned int order);
+
+/**
+ * unusable_index(@order)
+ *
+ * RETURN
+ *   The ratio of free page frames that cannot be allocated as blocks of
+ *   (1 << @order) page frames, in thousandths
+ */
+unsigned int unusable_index(unsigned int order);
+
+/**
+ * largest_free_order()
+ *
+ * RETURN
+ *   The order of the largest free block
+ *   -1 if no page frame is free
+ */
+int largest_free_order(void);
+
+/**
+ * next_free_frame(@pfn)
+ *
+ * RETURN
+ *   The smallest PFN that is free and is equal to or larger than @pfn
+ *   @nr_pageframes if there is no such page frame
+ */
+unsigned int next_free_frame(unsigned int pfn);
+
+/**
+ * next_mapped_frame(@pfn)
+ *
+ * RETURN
+ *   The smallest PFN that is mapped and is equal to or larger than @pfn
+ *   @nr_pageframes if there is no such page frame
+ */
+unsigned int next_mapped_frame(unsigned int pfn);
+
+/**
+ * get_page(@pfn)/put_page(@pfn)
+ *
+ * DESCRIPTION
+ *   Increase/decrease the map count of @pfn. A page frame becomes free when
+ *   its map count drops to 0. Always use these instead of modifying
+ *   @mapcounts directly so that the free frame bitmap is kept in sync.
+ */
+void get_page(unsigned int pfn);
+void put_page(unsigned int pfn);
+
+/**
+ * frame_movable(@pfn)
+ *
+ * RETURN
+ *   @true if @pfn is in use, is not pinned, and all of its mappings can be
+ *   found through the reverse mapping, so it can be migrated
+ */
+bool frame_movable(unsigned int pfn);
+
+/**
+ * move_frame(@to, @from)
+ *
+ * DESCRIPTION
+ *   Move the map count, the reverse mappings, the contents, and the place in
+ *   the page replacement order of @from to the free page frame @to, and free
+ *   @from. The caller should update the PTEs mapping @from.
+ */
+void move_frame(unsigned int to, unsigned int from);
+
+/**
+ * Reverse mapping. Each page frame keeps the list of (process, VPN) pairs
+ * mapping it, so the PTEs mapping a page frame can be found without walking
+ * the page tables of all processes. Add or remove an entry whenever a PTE
+ * starts or stops mapping the page frame, along with get_page()/put_page().
+ */
+struct rmap {
+	struct process *process;
+	unsigned long vpn;
+	struct hlist_node hnode;
+};
+
+extern struct hlist_head *rmaps;
+
+/**
+ * add_rmap(@pfn, @p, @vpn)/remove_rmap(@pfn, @p, @vpn)
+ *
+ * DESCRIPTION
+ *   Add or remove the reverse mapping of @pfn from @vpn of @p.
+ *
+ * RETURN
+ *   0 on success
+ *   -1 if add_rmap() is unable to allocate the entry
+ */
+int add_rmap(unsigned int pfn, struct process *p, unsigned long vpn);
+void remove_rmap(unsigned int pfn, struct process *p, unsigned long vpn);
+
+/**
+ * for_each_rmap(@r, @n, @pfn)
+ *
+ * DESCRIPTION
+ *   Iterate over the reverse mappings of @pfn with @r. It is safe to remove
+ *   @r while iterating; @n is used as temporary storage.
+ */
+#define for_each_rmap(r, n, pfn) \
+	hlist_for_each_entry_safe(r, n, &rmaps[pfn], hnode)
+
+/**
+ * Page replacement policy to pick the victim page frame when the memory is
+ * full. Should be set before init_frames().
+ */
+enum reclaim_policy {
+	RECLAIM_NONE = 0,
+	RECLAIM_FIFO,
+	RECLAIM_CLOCK,
+	RECLAIM_LRU,
+};
+extern enum reclaim_policy reclaim_policy;
+
+/**
+ * set_reclaim_policy(@name)
+ *
+ * RETURN
+ *   0 if @name is one of fifo, clock, and lru
+ *   -1 otherwise
+ */
+int set_reclaim_policy(const char *name);
+
+/**
+ * select_victim_frame()
+ *
+ * DESCRIPTION
+ *   Pick an in-use page frame to evict according to @reclaim_policy.
+ *   The page frame is not unmapped by this function.
+ *
+ * RETURN
+ *   PFN of the victim
+ *   -1 if no page frame can be evicted
+ */
+unsigned int select_victim_frame(void);
+
+/**
+ * pin_frame(@pfn)/unpin_frame(@pfn)
+ *
+ * DESCRIPTION
+ *   Prevent/allow @pfn from being picked as the victim.
+ */
+void pin_frame(unsigned int pfn);
+void unpin_frame(unsigned int pfn);
+
+/**
+ * Data held by each page frame, which is tracked only if the page replacement
+ * is enabled. Otherwise it is NULL.
+ *
+ * init_frame_content(@pfn) fills @pfn with new data, and
+ * copy_frame_content(@to, @from) copies the data of @from to @to.
+ */
+extern unsigned long *frame_contents;
+void init_frame_content(unsigned int pfn);
+void copy_frame_content(unsigned int to, unsigned int from);
+
+/**
+ * page_referenced(@pfn)
+ *
+ * DESCRIPTION
+ *   Test and clear the accessed bits of PTEs mapping @pfn. Provided by the
+ *   page table management.
+ *
+ * RETURN
+ *   @true if any PTE mapping @pfn has been accessed since the last call
+ */
+bool page_referenced(unsigned int pfn);
+
+#endif
@@ -0,0 +1,384 @@
+/**********************************************************************
+ * Copyright (c) 2020-2021
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <math.h>
+#include <sys/mman.h>
+
+#include "types.h"
+#include "list_head.h"
+#include "vm.h"
+#include "pgtable.h"
+#include "trace.h"
+#include "parser.h"
+#include "gen.h"
+
+enum {
+	GEN_OPT_LENGTH = GEN_FORK + 1,
+	GEN_OPT_SEED,
+	GEN_OPT_PAGES,
+	GEN_OPT_PROCS,
+	GEN_OPT_SWITCH,
+	GEN_OPT_WRITE,
+	GEN_OPT_STRIDE,
+	GEN_OPT_SKEW,
+	GEN_OPT_HOT,
+	GEN_OPT_PERIOD,
+};
+
+/* The patterns come first, indexed by enum gen_pattern */
+static char *const gen_tokens[] = {
+	[GEN_SEQUENTIAL] = "seq",
+	[GEN_STRIDED] = "strided",
+	[GEN_UNIFORM] = "uniform",
+	[GEN_ZIPF] = "zipf",
+	[GEN_PHASE] = "phase",
+	[GEN_FORK] = "fork",
+	[GEN_OPT_LENGTH] = "length",
+	[GEN_OPT_SEED] = "seed",
+	[GEN_OPT_PAGES] = "pages",
+	[GEN_OPT_PROCS] = "procs",
+	[GEN_OPT_SWITCH] = "switch",
+	[GEN_OPT_WRITE] = "write",
+	[GEN_OPT_STRIDE] = "stride",
+	[GEN_OPT_SKEW] = "skew",
+	[GEN_OPT_HOT] = "hot",
+	[GEN_OPT_PERIOD] = "period",
+	NULL,
+};
+
+static int __parse_uint(const char *value, unsigned int *result)
+{
+	unsigned long v;
+
+	if (parse_ulong(value, UINT_MAX, &v)) return -1;
+
+	*result = v;
+	return 0;
+}
+
+static int __parse_double(const char *value, double *result)
+{
+	char *end;
+	double v;
+
+	errno = 0;
+	v = strtod(value, &end);
+	if (*end || errno || !isfinite(v)) return -1;
+
+	*result = v;
+	return 0;
+}
+
+int parse_gen_params(const char *spec, struct gen_params *params)
+{
+	char *options = strdup(spec);
+	char *pos = options;
+	char *value;
+	int ret = 0;
+
+	*params = (struct gen_params) {
+		.pattern = GEN_UNIFORM,
+		.length = 10000,
+		.seed = 1,
+		.nr_pages = 32,
+		.write_percent = 30,
+		.stride = 8,
+		.skew = 0.99,
+	};
+
+	while (*pos && !ret) {
+		int token = getsubopt(&pos, gen_tokens, &value);
+
+		if (token >= 0 && token <= GEN_FORK) {
+			if (value) ret = -1;
+			params->pattern = token;
+			continue;
+		}
+		if (token < 0 || !value || !*value) {
+			ret = -1;
+			break;
+		}
+
+		switch (token) {
+		case GEN_OPT_LENGTH:
+			ret = parse_ulong(value, ULONG_MAX, &params->length);
+			break;
+		case GEN_OPT_SEED:
+			ret = parse_ulong(value, ULONG_MAX, &params->seed);
+			break;
+		case GEN_OPT_PAGES:
+			ret = parse_ulong(value, ULONG_MAX, &params->nr_pages);
+			break;
+		case GEN_OPT_PROCS:
+			ret = __parse_uint(value, &params->nr_procs);
+			break;
+		case GEN_OPT_SWITCH:
+			ret = __parse_uint(value, &params->switch_interval);
+			break;
+		case GEN_OPT_WRITE:
+			ret = __parse_uint(value, &params->write_percent);
+			break;
+		case GEN_OPT_STRIDE:
+			ret = parse_ulong(value, ULONG_MAX, &params->stride);
+			break;
+		case GEN_OPT_SKEW:
+			ret = __parse_double(value, &params->skew);
+			break;
+		case GEN_OPT_HOT:
+			ret = parse_ulong(value, ULONG_MAX, &params->nr_hot);
+			break;
+		case GEN_OPT_PERIOD:
+			ret = parse_ulong(value, ULONG_MAX, &params->phase_len);
+			break;
+		}
+	}
+	free(options);
+
+	if (ret) {
+		fprintf(stderr, "Unknown workload %s\n", spec);
+		return -1;
+	}
+
+	/* The fork storm switches among 8 processes every 4 accesses */
+	if (!params->nr_procs) {
+		params->nr_procs = params->pattern == GEN_FORK ? 8 : 1;
+	}
+	if (!params->switch_interval && params->nr_procs > 1) {
+		params->switch_interval = params->pattern == GEN_FORK ? 4 : 64;
+	}
+	if (!params->nr_hot) params->nr_hot = (params->nr_pages + 3) / 4;
+	if (!params->phase_len) {
+		params->phase_len = params->length / 8 ? params->length / 8 : 1;
+	}
+
+	return 0;
+}
+
+/**
+ * The xorshift64* generator, which is seeded through splitmix64 so that
+ * close seeds give unrelated workloads
+ */
+static uint64_t __next_random(uint64_t *state)
+{
+	uint64_t x = *state;
+
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*state = x;
+
+	return x * 0x2545f4914f6cdd1dULL;
+}
+
+static uint64_t __seed_random(unsigned long seed)
+{
+	uint64_t z = seed + 0x9e3779b97f4a7c15ULL;
+
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	z ^= z >> 31;
+
+	return z ? z : 1;
+}
+
+static inline unsigned long __random_below(uint64_t *state, unsigned long n)
+{
+	return __next_random(state) % n;
+}
+
+static int __init_zipf(struct zipf *zipf, const struct gen_params *params, uint64_t *state)
+{
+	unsigned long n = params->nr_pages;
+	double sum = 0;
+
+	zipf->cdf = malloc(sizeof(*zipf->cdf) * n);
+	zipf->pages = malloc(sizeof(*zipf->pages) * n);
+	if (!zipf->cdf || !zipf->pages) {
+		free(zipf->cdf);
+		free(zipf->pages);
+		return -1;
+	}
+
+	for (unsigned long i = 0; i < n; i++) {
+		sum += pow(i + 1, -params->skew);
+		zipf->cdf[i] = sum;
+		zipf->pages[i] = i;
+	}
+	for (unsigned long i = 0; i < n; i++) {
+		zipf->cdf[i] /= sum;
+	}
+
+	for (unsigned long i = n - 1; i > 0; i--) {
+		unsigned long j = __random_below(state, i + 1);
+		unsigned long page = zipf->pages[i];
+
+		zipf->pages[i] = zipf->pages[j];
+		zipf->pages[j] = page;
+	}
+	return 0;
+}
+
+static unsigned long __sample_zipf(const struct zipf *zipf, unsigned long n, uint64_t *state)
+{
+	double u = (__next_random(state) >> 11) * 0x1.0p-53;
+	unsigned long lo = 0, hi = n - 1;
+
+	while (lo < hi) {
+		unsigned long mid = lo + (hi - lo) / 2;
+
+		if (zipf->cdf[mid] > u) {
+			hi = mid;
+		} else {
+			lo = mid + 1;
+		}
+	}
+	return zipf->pages[lo];
+}
+
+int init_generator(struct generator *gen, const struct gen_params *params)
+{
+	unsigned long nr_pages = params->nr_pages;
+
+	if (!nr_pages || nr_pages > (1UL << nr_vpn_bits())) {
+		fprintf(stderr, "The workload should have 1 to %lu pages\n",
+				1UL << nr_vpn_bits());
+		return -1;
+	}
+	if (params->switch_interval && params->nr_procs < 2) {
+		fprintf(stderr, "The workload should have 2 or more processes to switch\n");
+		return -1;
+	}
+	if (params->write_percent > 100 || params->nr_hot > nr_pages ||
+			(params->pattern == GEN_STRIDED && !params->stride)) {
+		fprintf(stderr, "Invalid parameters for the workload\n");
+		return -1;
+	}
+
+	*gen = (struct generator) {
+		.params = *params,
+		.state = __seed_random(params->seed),
+	};
+
+	if (params->pattern == GEN_ZIPF && __init_zipf(&gen->zipf, params, &gen->state)) {
+		fprintf(stderr, "Unable to allocate the Zipf distribution\n");
+		return -1;
+	}
+	return 0;
+}
+
+void exit_generator(struct generator *gen)
+{
+	free(gen->zipf.cdf);
+	free(gen->zipf.pages);
+}
+
+static struct trace_record __generate_access(struct generator *gen)
+{
+	const struct gen_params *params = &gen->params;
+	unsigned long nr_pages = params->nr_pages;
+	unsigned long i = gen->nr_accesses++;
+	unsigned long vpn;
+	unsigned int rw;
+
+	switch (params->pattern) {
+	case GEN_SEQUENTIAL:
+		vpn = i % nr_pages;
+		break;
+	case GEN_STRIDED:
+		vpn = (i * params->stride + i * params->stride / nr_pages) % nr_pages;
+		break;
+	case GEN_ZIPF:
+		vpn = __sample_zipf(&gen->zipf, nr_pages, &gen->state);
+		break;
+	case GEN_PHASE:
+		if (i % params->phase_len == 0) {
+			gen->hot_base = __random_below(&gen->state, nr_pages - params->nr_hot + 1);
+		}
+		vpn = gen->hot_base + __random_below(&gen->state, params->nr_hot);
+		break;
+	case GEN_UNIFORM:
+	case GEN_FORK:
+	default:
+		vpn = __random_below(&gen->state, nr_pages);
+		break;
+	}
+
+	rw = __random_below(&gen->state, 100) < params->write_percent ? RW_WRITE : RW_READ;
+
+	if (params->switch_interval && (i + 1) % params->switch_interval == 0) {
+		gen->switch_pending = true;
+	}
+	return make_trace_record(TRACE_ACCESS, rw, vpn);
+}
+
+size_t generate_records(struct generator *gen, struct trace_record *records, size_t nr_records)
+{
+	const struct gen_params *params = &gen->params;
+	size_t nr = 0;
+
+	while (nr < nr_records && gen->nr_allocs < params->nr_pages) {
+		records[nr++] = make_trace_record(TRACE_ALLOC, RW_READ | RW_WRITE, gen->nr_allocs++);
+	}
+
+	while (nr < nr_records) {
+		/* Never switch to the current process, which would fork it again */
+		if (gen->switch_pending) {
+			unsigned int next = __random_below(&gen->state, params->nr_procs - 1);
+
+			gen->pid = next >= gen->pid ? next + 1 : next;
+			gen->switch_pending = false;
+			records[nr++] = make_trace_record(TRACE_SWITCH, 0, gen->pid);
+			continue;
+		}
+		if (gen->nr_accesses == params->length) break;
+
+		records[nr++] = __generate_access(gen);
+	}
+	return nr;
+}
+
+int generate_trace(const struct gen_params *params, struct trace *trace)
+{
+	struct generator gen;
+	unsigned long nr_switches = 0;
+
+	if (init_generator(&gen, params)) return -1;
+
+	if (params->switch_interval) {
+		nr_switches = params->length / params->switch_interval;
+	}
+	trace->nr_records = params->nr_pages + params->length + nr_switches;
+	trace->size = trace->nr_records * sizeof(struct trace_record);
+	trace->map = mmap(NULL, trace->size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (trace->map == MAP_FAILED) {
+		fprintf(stderr, "Unable to allocate %lu records for the workload\n",
+				(unsigned long)trace->nr_records);
+		exit_generator(&gen);
+		return -1;
+	}
+
+	generate_records(&gen, trace->map, trace->nr_records);
+	exit_generator(&gen);
+
+	trace->records = trace->map;
+	return 0;
+}
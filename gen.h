@@ -0,0 +1,132 @@
+/**********************************************************************
+ * Copyright (c) 2020-2021
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#ifndef __GEN_H__
+#define __GEN_H__
+
+#include "types.h"
+#include "trace.h"
+
+/**
+ * Synthetic workloads
+ *
+ * A synthetic workload allocates @nr_pages pages from VPN 0 for read and
+ * write in process 0, and then accesses them @length times in the pattern.
+ * Every @switch_interval accesses, the workload switches to a random process
+ * among @nr_procs processes, which forks the process on its first switch.
+ * The workloads are the same for the same parameters, including @seed.
+ */
+enum gen_pattern {
+	GEN_SEQUENTIAL = 0,	/* VPN 0, 1, 2, ... over and over */
+	GEN_STRIDED,		/* Every @stride pages, shifted by one on wrap */
+	GEN_UNIFORM,		/* Uniformly at random */
+	GEN_ZIPF,		/* Zipf-distributed ranks of @skew over scattered pages */
+	GEN_PHASE,		/* Uniformly in @nr_hot pages moving every @phase_len accesses */
+	GEN_FORK,		/* Uniformly, switching among processes every few accesses */
+};
+
+struct gen_params {
+	enum gen_pattern pattern;
+	unsigned long length;
+	unsigned long seed;
+	unsigned long nr_pages;
+	unsigned int nr_procs;
+	unsigned int switch_interval;
+	unsigned int write_percent;
+	unsigned long stride;
+	double skew;
+	unsigned long nr_hot;
+	unsigned long phase_len;
+};
+
+/**
+ * parse_gen_params(@spec, @params)
+ *
+ * DESCRIPTION
+ *   Parse the pattern and the comma-separated parameters in @spec, such as
+ *   "zipf,length=100000,pages=64,skew=0.9", into @params. The parameters
+ *   not in @spec are left to the defaults of the pattern.
+ *
+ * RETURN
+ *   0 on success
+ *   -1 if @spec is malformed
+ */
+int parse_gen_params(const char *spec, struct gen_params *params);
+
+/**
+ * Ranks of the Zipf distribution are sampled from the cumulative distribution
+ * by a binary search, and are scattered over the pages so that the hot pages
+ * are not packed in the same page directories.
+ */
+struct zipf {
+	double *cdf;
+	unsigned long *pages;
+};
+
+/**
+ * A workload in generation. The records are generated on demand so that
+ * the workload is replayed in the memory of a few records however long it is.
+ */
+struct generator {
+	struct gen_params params;
+	uint64_t state;
+	struct zipf zipf;
+	unsigned long nr_allocs;
+	unsigned long nr_accesses;
+	unsigned long hot_base;
+	unsigned int pid;
+	bool switch_pending;
+};
+
+/**
+ * init_generator(@gen, @params)
+ *
+ * DESCRIPTION
+ *   Start generating the workload of @params with @gen. The generator is
+ *   released with exit_generator().
+ *
+ * RETURN
+ *   0 on success
+ *   -1 if @params is invalid or on error
+ */
+int init_generator(struct generator *gen, const struct gen_params *params);
+void exit_generator(struct generator *gen);
+
+/**
+ * generate_records(@gen, @records, @nr_records)
+ *
+ * DESCRIPTION
+ *   Generate up to @nr_records next records of the workload of @gen into
+ *   @records.
+ *
+ * RETURN
+ *   The number of records generated. 0 at the end of the workload.
+ */
+size_t generate_records(struct generator *gen, struct trace_record *records, size_t nr_records);
+
+/**
+ * generate_trace(@params, @trace)
+ *
+ * DESCRIPTION
+ *   Generate the whole workload of @params into @trace in the memory to be
+ *   saved as a binary trace. The trace is released with unmap_trace().
+ *
+ * RETURN
+ *   0 on success
+ *   -1 on error
+ */
+int generate_trace(const struct gen_params *params, struct trace *trace);
+
+#endif
@@ -16,10 +16,16 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <strings.h>
+#include <assert.h>
 
 #include "types.h"
 #include "list_head.h"
 #include "vm.h"
+#include "tlb.h"
+#include "frame.h"
+#include "swap.h"
+#include "slab.h"
+#include "pgtable.h"
 
 /**
  * Ready queue of the system
@@ -40,104 +46,704 @@ extern struct process *current;
 extern struct pagetable *ptbr;
 
 /**
- * TLB of the system.
+ * Page fault statistics. Major faults read the page back from the swap,
+ * and minor faults are resolved without I/O such as copy-on-write.
  */
-extern struct tlb_entry tlb[1UL << (PTES_PER_PAGE_SHIFT * 2)];
+unsigned long nr_major_faults = 0;
+unsigned long nr_minor_faults = 0;
+unsigned long nr_cow_copies = 0;
 
+/* The number of switches to existing processes */
+unsigned long nr_switches = 0;
 
 /**
- * The number of mappings for each page frame. Can be used to determine how
- * many processes are using the page frames.
+ * If set, fork shares the page directories of the parent with the child
+ * instead of copying them. A shared directory is copied when a process
+ * modifies it, and the MMU faults writes through the shared directories.
+ * Until then, the pages in a shared directory are mapped once in
+ * @mapcounts and in the reverse mapping, on behalf of all the sharers.
  */
-extern unsigned int mapcounts[];
+bool lazy_fork = false;
 
+/**
+ * If set, a contiguous allocation compacts the memory when there are not
+ * enough contiguous page frames
+ */
+bool auto_compact = false;
+
+/* Compaction statistics */
+unsigned long nr_compactions = 0;
+unsigned long nr_compact_moved = 0;
+unsigned long nr_compact_scanned = 0;
+unsigned long nr_compact_ptes = 0;
+
+/**
+ * Transparent huge pages. Once @thp_threshold pages are mapped through a page
+ * directory, the directory is promoted to a huge page on allocation, filling
+ * the rest of the pages with new page frames. Zero disables the promotion on
+ * allocation, and collapse_huge_pages() promotes full directories then.
+ */
+unsigned int thp_threshold = 0;
+unsigned long nr_thp_scanned = 0;
+
+/* The number of forks, and the page table entries visited to fork */
+unsigned long nr_forks = 0;
+unsigned long nr_fork_pt_visits = 0;
+
+/**
+ * Reference counts of the page directories shared by lazy fork. Directories
+ * not in the table are referenced by a single page table.
+ */
+struct shared_pd {
+	struct pte_directory *pd;
+	unsigned int refcount;
+	struct hlist_node hnode;
+};
+
+#define NR_SHARED_PD_HEADS	64
+static struct hlist_head shared_pds[NR_SHARED_PD_HEADS];
+
+static inline struct hlist_head *__shared_pd_head(struct pte_directory *pd)
+{
+	return &shared_pds[((unsigned long)pd / pte_directory_cache.size) % NR_SHARED_PD_HEADS];
+}
+
+static struct shared_pd *__find_shared_pd(struct pte_directory *pd)
+{
+	struct shared_pd *s;
+
+	hlist_for_each_entry(s, __shared_pd_head(pd), hnode) {
+		if(s->pd == pd) return s;
+	}
+	return NULL;
+}
+
+static bool __get_shared_pd(struct pte_directory *pd)
+{
+	struct shared_pd *s = __find_shared_pd(pd);
+
+	if(!s) {
+		s = malloc(sizeof(*s));
+		if(!s) return false;
+
+		s->pd = pd;
+		s->refcount = 1;
+		hlist_add_head(&s->hnode, __shared_pd_head(pd));
+	}
+	s->refcount++;
+
+	return true;
+}
+
+static void __put_shared_pd(struct pte_directory *pd)
+{
+	struct shared_pd *s = __find_shared_pd(pd);
+
+	if(--s->refcount == 1) {
+		hlist_del(&s->hnode);
+		free(s);
+	}
+}
+
+/**
+ * __invalidate_tlb_sharers(@pd, @vpn)
+ *
+ * DESCRIPTION
+ *   Invalidate the TLB entries for @vpn of all processes mapping @vpn
+ *   through @pd.
+ */
+static void __invalidate_tlb_sharers(struct pte_directory *pd, unsigned long vpn)
+{
+	struct process *p;
+	struct pt_entry *pde;
+
+	pde = lookup_pd(&current->pagetable, vpn);
+	if(pde && pde->next == pd) {
+		invalidate_tlb(current, vpn);
+	}
+	list_for_each_entry(p, &processes, list) {
+		pde = lookup_pd(&p->pagetable, vpn);
+		if(pde && pde->next == pd) {
+			invalidate_tlb(p, vpn);
+		}
+	}
+}
+
+static void __invalidate_tlb_shared(struct process *p, unsigned long vpn)
+{
+	struct pt_entry *pde = lazy_fork ? lookup_pd(&p->pagetable, vpn) : NULL;
+
+	if(pde && pde->shared) {
+		__invalidate_tlb_sharers(pde->next, vpn);
+	} else {
+		invalidate_tlb(p, vpn);
+	}
+}
+
+static bool __rmap_exists(unsigned int pfn, struct process *p, unsigned long vpn)
+{
+	struct rmap *r;
+	struct hlist_node *n;
+
+	for_each_rmap(r, n, pfn) {
+		if(r->process == p && r->vpn == vpn) return true;
+	}
+	return false;
+}
+
+static void __undo_unshare(struct pte_directory *pd, unsigned long start, unsigned long nr_copied)
+{
+	for(unsigned long j = 0; j < nr_copied; j++) {
+		struct pte *pte = &pd->ptes[j];
+		unsigned int pfn = pte_pfn(pte);
+
+		// the directory stays shared, so either sharer can keep the reverse mapping
+		if(pte_swapped(pte)) {
+			swap_free(pfn);
+		} else if(pte_valid(pte)) {
+			put_page(pfn);
+			remove_rmap(pfn, current, start + j);
+		}
+	}
+}
 
 /**
- * lookup_tlb(@vpn, @pfn)
+ * __unshare_pagetable(@vpn)
  *
  * DESCRIPTION
- *   Translate @vpn of the current process through TLB. DO NOT make your own
- *   data structure for TLB, but use the defined @tlb data structure
- *   to translate. If the requested VPN exists in the TLB, return true
- *   with @pfn is set to its PFN. Otherwise, return false.
- *   The framework calls this function when needed, so do not call
- *   this function manually.
+ *   Give the current process its own copy of the page directory covering
+ *   @vpn if the directory is shared by lazy fork. The pages mapped for writes
+ *   are write-protected in both directories as the eager fork does. The
+ *   reverse mappings naming the current process are handed over to another
+ *   sharer of the original directory.
  *
  * RETURN
- *   Return true if the translation is cached in the TLB.
- *   Return false otherwise
+ *   @true if the current process owns the page directory exclusively, or
+ *   the directory does not exist
+ *   @false if unable to allocate the copy
  */
-bool lookup_tlb(unsigned int vpn, unsigned int *pfn)
+static bool __unshare_pagetable(unsigned long vpn)
 {
-	
-	for(int i=0; i < NR_TLB_ENTRIES; i++) {
-		struct tlb_entry *t = &tlb[i];
+	struct pt_entry *pde;
+	struct pte_directory *pd;
+	struct pte_directory *newpd;
+	struct process *sharer = NULL;
+	struct process *p;
+	unsigned long start = vpn & ~((1UL << pt_bits) - 1);
+
+	if(!lazy_fork) return true;
+
+	pde = lookup_pd(&current->pagetable, vpn);
+	if(!pde || !pde->shared) return true;
+
+	pd = pde->next;
+
+	// the other processes have copied the directory already
+	if(!__find_shared_pd(pd)) {
+		pde->shared = false;
+		return true;
+	}
+
+	newpd = kmem_cache_alloc(&pte_directory_cache);
+	if(!newpd) return false;
 
-		if (!t->valid) continue;
+	list_for_each_entry(p, &processes, list) {
+		struct pt_entry *e = lookup_pd(&p->pagetable, vpn);
 
-		if (t->vpn == vpn) {
-			*pfn = t->pfn;
-			return true;
+		if(e && e->next == pd) {
+			sharer = p;
+			break;
 		}
 	}
-	
-	return false;
+	assert(sharer);
+
+	for(unsigned long j = 0; j < (1UL << pt_bits); j++) {
+		struct pte *pte = &pd->ptes[j];
+		unsigned int pfn = pte_pfn(pte);
+
+		if(pte_swapped(pte)) {
+			swap_dup(pfn);
+		} else if(pte_valid(pte)) {
+			if(pte_writable(pte)) {
+				pte_clear_flags(pte, PTE_WRITABLE);
+				__invalidate_tlb_sharers(pd, start + j);
+			}
+
+			if(add_rmap(pfn, __rmap_exists(pfn, current, start + j) ? sharer : current, start + j)) {
+				__undo_unshare(pd, start, j);
+				kmem_cache_free(&pte_directory_cache, newpd);
+				return false;
+			}
+			get_page(pfn);
+		}
+		newpd->ptes[j] = *pte;
+	}
+
+	__put_shared_pd(pd);
+
+	pde->next = newpd;
+	pde->shared = false;
+	invalidate_pwc(pd_index(vpn));
+
+	return true;
+}
+
+
+typedef void (*mapping_fn)(struct process *p, unsigned long vpn, struct pte *pte, void *data);
+
+/**
+ * __for_each_mapping(@pfn, @fn, @data)
+ *
+ * DESCRIPTION
+ *   Call @fn for every PTE mapping @pfn through the reverse mapping of @pfn.
+ *   @fn may unmap the PTE.
+ */
+static void __for_each_mapping(unsigned int pfn, mapping_fn fn, void *data)
+{
+	struct rmap *r;
+	struct hlist_node *n;
+
+	for_each_rmap(r, n, pfn) {
+		fn(r->process, r->vpn, lookup_pte(&r->process->pagetable, r->vpn), data);
+	}
+}
+
+static void __test_and_clear_accessed(struct process *p, unsigned long vpn, struct pte *pte, void *data)
+{
+	bool *referenced = data;
+
+	if(!pte_accessed(pte)) return;
+
+	pte_clear_flags(pte, PTE_ACCESSED);
+	*referenced = true;
+
+	// TLB hits do not set the accessed bit. Make the next access walk again
+	__invalidate_tlb_shared(p, vpn);
+}
+
+bool page_referenced(unsigned int pfn)
+{
+	bool referenced = false;
+
+	__for_each_mapping(pfn, __test_and_clear_accessed, &referenced);
+
+	return referenced;
+}
+
+static void __unmap_to_swap(struct process *p, unsigned long vpn, struct pte *pte, void *data)
+{
+	unsigned int slot = *(unsigned int *)data;
+	unsigned int pfn = pte_pfn(pte);
+
+	// the PTE being swapped in into the page frame already has its reverse mapping
+	if(pte_swapped(pte)) return;
+
+	// keep PTE_COW so that the page is writable again once swapped in
+	set_pte(pte, slot, PTE_SWAPPED | (pte_flags(pte) & PTE_COW));
+
+	swap_dup(slot);
+	put_page(pfn);
+	remove_rmap(pfn, p, vpn);
 
+	__invalidate_tlb_shared(p, vpn);
 }
 
+/**
+ * __reclaim_frame()
+ *
+ * DESCRIPTION
+ *   Evict the page frame picked by the page replacement policy to the swap.
+ *   All PTEs mapping the page frame are turned into swap entries pointing to
+ *   the swap slot holding the page.
+ *
+ * RETURN
+ *   PFN of the reclaimed page frame, which is free now
+ *   -1 if unable to reclaim
+ */
+static unsigned int __reclaim_frame(void)
+{
+	unsigned int pfn = select_victim_frame();
+	unsigned int slot;
+
+	if(pfn == -1) return -1;
+
+	slot = alloc_swap_slot();
+	if(slot == -1) return -1;
+
+	swap_out(pfn, slot);
+	__for_each_mapping(pfn, __unmap_to_swap, &slot);
+
+	return pfn;
+}
+
+static unsigned int __get_free_frame(void)
+{
+	unsigned int pfn = get_free_frame();
+
+	if(pfn == -1 && nr_swap_slots) {
+		pfn = __reclaim_frame();
+	}
+	return pfn;
+}
+
+static void __remap_frame(struct process *p, unsigned long vpn, struct pte *pte, void *data)
+{
+	unsigned int pfn = *(unsigned int *)data;
+
+	set_pte(pte, pfn, pte_flags(pte));
+	nr_compact_ptes++;
+
+	__invalidate_tlb_shared(p, vpn);
+}
+
+/**
+ * compact_memory(@order)
+ *
+ * DESCRIPTION
+ *   Migrate the in-use page frames at the top of the memory to the free page
+ *   frames at the bottom. The free scanner goes up from the lowest PFN, and
+ *   the migration scanner goes down from the highest PFN until they meet.
+ *   All PTEs mapping a migrated page frame are updated through the reverse
+ *   mapping. The compaction stops early once a free block of @order is
+ *   available, or runs through the entire memory if @order is negative.
+ */
+void compact_memory(int order)
+{
+	unsigned int free_pfn = 0;
+	unsigned int migrate_pfn = nr_pageframes;
+
+	nr_compactions++;
+
+	while(order < 0 || largest_free_order() < order) {
+		free_pfn = next_free_frame(free_pfn);
+
+		do {
+			migrate_pfn--;
+			nr_compact_scanned++;
+		} while(migrate_pfn > free_pfn && !frame_movable(migrate_pfn));
+
+		if(migrate_pfn <= free_pfn) break;
+
+		move_frame(free_pfn, migrate_pfn);
+		__for_each_mapping(free_pfn, __remap_frame, &free_pfn);
+		nr_compact_moved++;
+	}
+}
+
+static unsigned int __get_free_frames(unsigned int nr_frames)
+{
+	unsigned int pfn = get_free_frames(nr_frames);
+
+	if(pfn == -1 && auto_compact) {
+		compact_memory(order_of_frames(nr_frames));
+		pfn = get_free_frames(nr_frames);
+	}
+	return pfn;
+}
+
+struct swapin_control {
+	struct process *process;
+	unsigned int slot;
+	unsigned int pfn;
+};
+
+static void __set_swapped_pte(struct pte *pte, struct swapin_control *sc)
+{
+	// mapped read-only; the pages mapped for writes stay copy-on-write
+	set_pte(pte, sc->pfn, PTE_VALID | (pte_flags(pte) & PTE_COW));
+	get_page(sc->pfn);
+	swap_free(sc->slot);
+}
+
+// the PTEs left without the reverse mapping keep the swap entry
+static void __map_swapped_pte(struct pte *pte, unsigned long vpn, void *data)
+{
+	struct swapin_control *sc = data;
+
+	if(!pte_swapped(pte) || pte_pfn(pte) != sc->slot) return;
+
+	if(add_rmap(sc->pfn, sc->process, vpn)) return;
+
+	__set_swapped_pte(pte, sc);
+}
 
 /**
- * insert_tlb(@vpn, @pfn)
+ * __swap_in_page(@vpn, @pte)
  *
  * DESCRIPTION
- *   Insert the mapping from @vpn to @pfn into the TLB. The framework will call
- *   this function when required, so no need to call this function manually.
+ *   Get a page frame for the page swapped out from @pte of the current
+ *   process, and read the page into it. The page is mapped into every PTE
+ *   referring to the swap slot, so the processes sharing the slot since fork
+ *   keep sharing the page, and the slot is released. If the memory is full
+ *   and @pte holds the only reference to the slot, the victim of the page
+ *   replacement takes the slot in exchange, so the page can be swapped in
+ *   even when the swap area is full.
  *
+ * RETURN
+ *   PFN of the page frame holding the page
+ *   -1 if unable to get a page frame
  */
-void insert_tlb(unsigned int vpn, unsigned int pfn)
+static unsigned int __swap_in_page(unsigned long vpn, struct pte *pte)
 {
-	for(int i=0; i < NR_TLB_ENTRIES; i++) {
+	struct swapin_control sc = {
+		.process = current,
+		.slot = pte_pfn(pte),
+	};
+	struct process *p;
 
-		struct tlb_entry *t = &tlb[i];
+	sc.pfn = get_free_frame();
 
-		if (!t->valid) {
-			t->valid = true;
-			t->vpn = vpn;
-			t->pfn = pfn;
-			return;
+	if(sc.pfn == -1 && swap_count(sc.slot) == 1) {
+		sc.pfn = select_victim_frame();
+		if(sc.pfn == -1) return -1;
+
+		// the victim cannot be put back once exchanged; take the reverse mapping first
+		if(add_rmap(sc.pfn, current, vpn)) return -1;
+
+		swap_exchange(sc.pfn, sc.slot);
+		__for_each_mapping(sc.pfn, __unmap_to_swap, &sc.slot);
+		__set_swapped_pte(pte, &sc);
+
+		return sc.pfn;
+	}
+
+	if(sc.pfn == -1) sc.pfn = __reclaim_frame();
+	if(sc.pfn == -1) return -1;
+
+	swap_in(sc.slot, sc.pfn);
+
+	if(swap_count(sc.slot) == 1) {
+		__map_swapped_pte(pte, vpn, &sc);
+	} else {
+		for_each_pte(&current->pagetable, __map_swapped_pte, &sc);
+		list_for_each_entry(p, &processes, list) {
+			sc.process = p;
+			for_each_pte(&p->pagetable, __map_swapped_pte, &sc);
 		}
+	}
+
+	// the page stays in the swap slot if unable to map it
+	if(!pte_valid(pte)) return -1;
+
+	return sc.pfn;
+}
 
+/**
+ * Huge pages are mapped through the first page frame. Each page frame counts
+ * the mappings of the huge page, but only the first one has the reverse
+ * mappings. Huge pages are not swapped, so their page frames are pinned
+ * while they are mapped.
+ */
+static void __get_huge_page(unsigned int pfn)
+{
+	for(unsigned int i = 0; i < pages_per_huge_page(); i++) {
+		get_page(pfn + i);
+		pin_frame(pfn + i);
 	}
 }
 
-void free_tlb(unsigned int vpn) {
+static void __put_huge_page(unsigned int pfn)
+{
+	for(unsigned int i = 0; i < pages_per_huge_page(); i++) {
+		put_page(pfn + i);
+		if(mapcounts[pfn + i] == 0) {
+			unpin_frame(pfn + i);
+		}
+	}
+}
 
-	for(int i=0; i < NR_TLB_ENTRIES; i++) {
 
-		struct tlb_entry *t = &tlb[i];
+/**
+ * __promote_huge_page(@p, @vpn, @threshold)
+ *
+ * DESCRIPTION
+ *   Promote the page directory covering @vpn of @p to a transparent huge page
+ *   if @threshold or more pages are mapped through it. The pages should be
+ *   present, mapped by @p only, and mapped either all for read or all for
+ *   write. The pages not mapped yet are filled with new page frames. Pages
+ *   already in an aligned block of page frames in order become the huge page
+ *   in place. Otherwise they are copied to new contiguous page frames.
+ *
+ * RETURN
+ *   @true if the directory is promoted
+ *   @false otherwise
+ */
+static bool __promote_huge_page(struct process *p, unsigned long vpn, unsigned int threshold)
+{
+	unsigned long nr_pages = pages_per_huge_page();
+	unsigned long start = vpn & ~(nr_pages - 1);
+	struct pt_entry *pde = lookup_pd(&p->pagetable, vpn);
+	struct pte *pte;
+	unsigned int flags = 0;
+	unsigned int pfn;
+	bool in_place;
+
+	if(pde == NULL || pde->shared || pde->nr_used < threshold) {
+		return false;
+	}
+
+	pfn = pte_pfn(pd_pte(pde, start));
+	in_place = (pde->nr_used == nr_pages) && (pfn & (nr_pages - 1)) == 0;
+
+	for(unsigned long i = 0; i < nr_pages; i++) {
+		pte = pd_pte(pde, start + i);
+
+		if(pte_none(pte)) continue;
+
+		if(pte_swapped(pte) || mapcounts[pte_pfn(pte)] != 1) {
+			return false;
+		}
+		if(flags && (pte_flags(pte) & PTE_COW) != (flags & PTE_COW)) {
+			return false;
+		}
+		if(pte_pfn(pte) != pfn + i) {
+			in_place = false;
+		}
+		flags |= pte_flags(pte);
+	}
+
+	if(in_place) {
+		for(unsigned long i = 0; i < nr_pages; i++) {
+			pin_frame(pfn + i);
+			if(i) remove_rmap(pfn + i, p, start + i);
+		}
+	} else {
+		pfn = __get_free_frames(nr_pages);
 
-		if (t->valid) {
-			if (t->vpn == vpn) {
-				t->valid = false;
-		 	}	
+		if(pfn == -1 || add_rmap(pfn, p, start)) {
+			return false;
 		}
 
+		// compaction may have moved the pages; read the PTEs again
+		__get_huge_page(pfn);
+		for(unsigned long i = 0; i < nr_pages; i++) {
+			pte = pd_pte(pde, start + i);
+
+			if(pte_none(pte)) {
+				init_frame_content(pfn + i);
+				continue;
+			}
+			copy_frame_content(pfn + i, pte_pfn(pte));
+			put_page(pte_pfn(pte));
+			remove_rmap(pte_pfn(pte), p, start + i);
+		}
 	}
 
-}
+	for(unsigned long i = 0; i < nr_pages; i++) {
+		invalidate_tlb(p, start + i);
+	}
+	if(p == current) {
+		invalidate_pwc(pd_index(start));
+	}
+
+	// exclusive pages mapped for write are writable right away
+	if(flags & PTE_COW) {
+		flags |= PTE_WRITABLE;
+	}
+	pte = collapse_pd(&p->pagetable, start);
+	set_pte(pte, pfn, PTE_VALID | PTE_HUGE | PTE_THP |
+			(flags & (PTE_WRITABLE | PTE_COW | PTE_ACCESSED | PTE_DIRTY)));
 
-void flush_tlb() {
+	p->nr_thp_promotions++;
 
-	for(int i=0; i < NR_TLB_ENTRIES; i++) {
+	return true;
+}
+
+static void __split_mapping(struct process *p, unsigned long vpn, struct pte *pte, void *data)
+{
+	bool *split = data;
+	unsigned int pfn = pte_pfn(pte);
+	unsigned long i;
 
-		struct tlb_entry *t = &tlb[i];
+	// the first page frame keeps the reverse mapping of the huge page
+	for(i = 1; i < pages_per_huge_page(); i++) {
+		if(add_rmap(pfn + i, p, vpn + i)) break;
+	}
 
-		if (t->valid) {
-			t->valid = false;
+	if(i < pages_per_huge_page() || split_huge_pte(&p->pagetable, vpn) == NULL) {
+		while(--i > 0) {
+			remove_rmap(pfn + i, p, vpn + i);
 		}
+		*split = false;
+		return;
+	}
+	invalidate_tlb(p, vpn);
+
+	p->nr_thp_demotions++;
+}
+
+/**
+ * __split_huge_page(@pfn)
+ *
+ * DESCRIPTION
+ *   Demote the transparent huge page at @pfn to small pages in all processes
+ *   mapping it, so that its pages can be changed one by one. The page frames
+ *   are unpinned as no huge page maps them anymore.
+ *
+ * RETURN
+ *   @true on success
+ *   @false if unable to split some of the mappings
+ */
+static bool __split_huge_page(unsigned int pfn)
+{
+	bool split = true;
+
+	__for_each_mapping(pfn, __split_mapping, &split);
 
+	if(split == false) {
+		return false;
 	}
 
+	for(unsigned long i = 0; i < pages_per_huge_page(); i++) {
+		unpin_frame(pfn + i);
+	}
+	return true;
+}
+
+struct collapse_control {
+	struct process *process;
+	unsigned int threshold;
+	unsigned int nr_promoted;
+};
+
+static void __collapse_pd(struct pt_entry *pde, unsigned long vpn, void *data)
+{
+	struct collapse_control *cc = data;
+
+	if(pde->huge) return;
+
+	nr_thp_scanned++;
+	if(__promote_huge_page(cc->process, vpn, cc->threshold)) {
+		cc->nr_promoted++;
+	}
+}
+
+/**
+ * collapse_huge_pages()
+ *
+ * DESCRIPTION
+ *   Scan the page directories of all processes in the background, and
+ *   promote the directories populated up to @thp_threshold, or fully if
+ *   the threshold is not set, to transparent huge pages.
+ *
+ * RETURN
+ *   The number of page directories promoted
+ */
+unsigned int collapse_huge_pages(void)
+{
+	struct collapse_control cc = {
+		.threshold = thp_threshold ? thp_threshold : pages_per_huge_page(),
+	};
+	struct process *p;
+
+	cc.process = current;
+	for_each_pd(&current->pagetable, __collapse_pd, &cc);
+
+	list_for_each_entry(p, &processes, list) {
+		cc.process = p;
+		for_each_pd(&p->pagetable, __collapse_pd, &cc);
+	}
+	return cc.nr_promoted;
 }
 
 
@@ -157,43 +763,85 @@ void flush_tlb() {
  *   Return allocated page frame number.
  *   Return -1 if all page frames are allocated.
  */
-unsigned int alloc_page(unsigned int vpn, unsigned int rw)
+unsigned int alloc_page(unsigned long vpn, unsigned int rw)
 {
-	int outIndex = vpn / NR_PTES_PER_PAGE;
-	int inIndex = vpn % NR_PTES_PER_PAGE;
+	unsigned int pfn = __get_free_frame();
 
-	if(current->pagetable.outer_ptes[outIndex] == NULL) {
-		current->pagetable.outer_ptes[outIndex] = (struct pte_directory *)malloc(sizeof(struct pte_directory));
+	if(pfn == -1) {
+		return -1;
+	}
+
+	if(!__unshare_pagetable(vpn) || add_rmap(pfn, current, vpn)) {
+		return -1;
 	}
 
-	int pfn;
+	// copy-on-write replaces the PTE in place
+	struct pte *pte = alloc_pte(&current->pagetable, vpn);
 
-	for(int i = 0; i < NR_PAGEFRAMES; i++) {
-		pfn = i;
-		if(mapcounts[i] == 0) {
-			break;
-		}
+	if(pte == NULL) {
+		remove_rmap(pfn, current, vpn);
+		return -1;
+	}
+
+	if(rw == RW_READ) {
+		set_pte(pte, pfn, PTE_VALID);
+	} else {
+		set_pte(pte, pfn, PTE_VALID | PTE_WRITABLE | PTE_COW);
+	}
+
+	get_page(pfn);
+	init_frame_content(pfn);
+
+	if(thp_threshold && __promote_huge_page(current, vpn, thp_threshold)) {
+		pte = lookup_pte(&current->pagetable, vpn);
+		pfn = pte_pfn(pte) + (vpn & (pages_per_huge_page() - 1));
 	}
 
-	if(mapcounts[pfn] == 16) {
+	return pfn;
+
+}
+
+
+/**
+ * alloc_huge_page(@vpn, @rw)
+ *
+ * DESCRIPTION
+ *   Allocate contiguous page frames as many as the pages covered by a page
+ *   directory, and map them to the range starting at @vpn with a single PTE
+ *   in place of the page directory. @vpn is aligned to the range, and no
+ *   page in the range is mapped.
+ *
+ * RETURN
+ *   Return the first page frame number.
+ *   Return -1 if there are no such page frames.
+ */
+unsigned int alloc_huge_page(unsigned long vpn, unsigned int rw)
+{
+	unsigned int pfn = __get_free_frames(pages_per_huge_page());
+
+	if(pfn == -1 || add_rmap(pfn, current, vpn)) {
 		return -1;
 	}
 
-	current->pagetable.outer_ptes[outIndex]->ptes[inIndex].valid = true;
-	current->pagetable.outer_ptes[outIndex]->ptes[inIndex].writable = false;
-	current->pagetable.outer_ptes[outIndex]->ptes[inIndex].pfn = pfn;
+	struct pte *pte = alloc_huge_pte(&current->pagetable, vpn);
 
-	if(rw == 1) {
-		current->pagetable.outer_ptes[outIndex]->ptes[inIndex].private = 1;
+	if(pte == NULL) {
+		remove_rmap(pfn, current, vpn);
+		return -1;
+	}
+
+	if(rw == RW_READ) {
+		set_pte(pte, pfn, PTE_VALID | PTE_HUGE);
 	} else {
-		current->pagetable.outer_ptes[outIndex]->ptes[inIndex].writable = true;
-		current->pagetable.outer_ptes[outIndex]->ptes[inIndex].private = 3;
+		set_pte(pte, pfn, PTE_VALID | PTE_WRITABLE | PTE_COW | PTE_HUGE);
 	}
 
-	mapcounts[pfn]++;
+	__get_huge_page(pfn);
+	for(unsigned int i = 0; i < pages_per_huge_page(); i++) {
+		init_frame_content(pfn + i);
+	}
 
 	return pfn;
-
 }
 
 
@@ -201,28 +849,105 @@ unsigned int alloc_page(unsigned int vpn, unsigned int rw)
  * free_page(@vpn)
  *
  * DESCRIPTION
- *   Deallocate the page from the current processor. Make sure that the fields
- *   for the corresponding PTE (valid, writable, pfn) is set @false or 0.
+ *   Deallocate the page from the current processor. Make sure that the
+ *   corresponding PTE is cleared.
  *   Also, consider carefully for the case when a page is shared by two processes,
- *   and one process is to free the page.
+ *   and one process is to free the page. A swapped-out page releases its
+ *   reference to the swap slot.
  */
-void free_page(unsigned int vpn)
+void free_page(unsigned long vpn)
 {
 
-	int outIndex = vpn / NR_PTES_PER_PAGE;
-	int inIndex = vpn % NR_PTES_PER_PAGE;
+	if(!__unshare_pagetable(vpn)) {
+		return;
+	}
 
-	int pfn = current->pagetable.outer_ptes[outIndex]->ptes[inIndex].pfn;
+	struct pte *pte = lookup_pte(&current->pagetable, vpn);
+	int pfn = pte_pfn(pte);
 
-	mapcounts[pfn]--;
+	// a transparent huge page is split to free the page alone
+	if(pte_thp(pte)) {
+		if(!__split_huge_page(pfn)) {
+			return;
+		}
+		pte = lookup_pte(&current->pagetable, vpn);
+		pfn = pte_pfn(pte);
+	}
 
-	current->pagetable.outer_ptes[outIndex]->ptes[inIndex].valid = false;
-	current->pagetable.outer_ptes[outIndex]->ptes[inIndex].writable = false;
-	current->pagetable.outer_ptes[outIndex]->ptes[inIndex].pfn = 0;
-	current->pagetable.outer_ptes[outIndex]->ptes[inIndex].private = 0;
+	// the whole huge page goes away along with its single PTE
+	if(pte_huge(pte)) {
+		vpn &= ~(pages_per_huge_page() - 1);
+
+		__put_huge_page(pfn);
+		remove_rmap(pfn, current, vpn);
+		clear_pte(pte);
+
+		free_tlb(vpn);
+		release_huge_pte(&current->pagetable, vpn);
+		invalidate_pwc(pd_index(vpn));
+		return;
+	}
+
+	if(pte_swapped(pte)) {
+		swap_free(pfn);
+	} else {
+		put_page(pfn);
+		remove_rmap(pfn, current, vpn);
+	}
+
+	clear_pte(pte);
 
 	free_tlb(vpn);
 
+	// the page directory is released once all of its PTEs are gone
+	if(put_pte(&current->pagetable, vpn)) {
+		invalidate_pwc(pd_index(vpn));
+	}
+
+}
+
+
+/**
+ * __handle_huge_cow(@vpn, @pte)
+ *
+ * DESCRIPTION
+ *   Handle the write fault on the huge page mapped by @pte. The huge page is
+ *   copied as a whole unless the current process is the only one mapping it.
+ */
+static bool __handle_huge_cow(unsigned long vpn, struct pte *pte)
+{
+	unsigned int pfn = pte_pfn(pte);
+	unsigned int newpfn;
+
+	if(pte_cow(pte) == false) {
+		return false;
+	}
+
+	vpn &= ~(pages_per_huge_page() - 1);
+
+	if(mapcounts[pfn] > 1) {
+		newpfn = __get_free_frames(pages_per_huge_page());
+
+		if(newpfn == -1 || add_rmap(newpfn, current, vpn)) {
+			return false;
+		}
+
+		__get_huge_page(newpfn);
+		for(unsigned int i = 0; i < pages_per_huge_page(); i++) {
+			copy_frame_content(newpfn + i, pfn + i);
+		}
+		nr_cow_copies++;
+		__put_huge_page(pfn);
+		remove_rmap(pfn, current, vpn);
+
+		set_pte(pte, newpfn, pte_flags(pte));
+		free_tlb(vpn);
+	}
+
+	pte_set_flags(pte, PTE_WRITABLE);
+	nr_minor_faults++;
+
+	return true;
 }
 
 
@@ -236,60 +961,97 @@ void free_page(unsigned int vpn)
  *   1. pte is invalid
  *   2. pte is not writable but @rw is for write
  *   This function should identify the situation, and do the copy-on-write if
- *   necessary.
+ *   necessary. An invalid pte may hold a swap entry, in which case the page is
+ *   read back from the swap.
  *
  * RETURN
  *   @true on successful fault handling
  *   @false otherwise
  */
-bool handle_page_fault(unsigned int vpn, unsigned int rw)
+bool handle_page_fault(unsigned long vpn, unsigned int rw)
 {
 
-	int outIndex = vpn / NR_PTES_PER_PAGE;
-	int inIndex = vpn % NR_PTES_PER_PAGE;
-	
 	// page directory is invalid
-	if(current->pagetable.outer_ptes[outIndex] == NULL) {
+	if(lookup_pte(&current->pagetable, vpn) == NULL) {
 		return false;
 	}
 
-	int pfn = current->pagetable.outer_ptes[outIndex]->ptes[inIndex].pfn;
+	// copy the page directory shared by lazy fork before touching it
+	if(!__unshare_pagetable(vpn)) {
+		return false;
+	}
 
-	// pte is invalid 
-	if(current->pagetable.outer_ptes[outIndex]->ptes[inIndex].valid == false) {
+	struct pte *pte = lookup_pte(&current->pagetable, vpn);
+	int pfn = pte_pfn(pte);
 
-		if(mapcounts[pfn] == 1) {
+	// the fault was only to copy the shared page directory
+	if(pte_valid(pte) && (rw == RW_READ || pte_writable(pte))) {
+		return true;
+	}
 
-			current->pagetable.outer_ptes[outIndex]->ptes[inIndex].valid = true;
+	// a shared transparent huge page is split to copy the written page only
+	if(pte_thp(pte) && mapcounts[pfn] > 1) {
+		if(!__split_huge_page(pfn)) {
+			return false;
+		}
+		pte = lookup_pte(&current->pagetable, vpn);
+		pfn = pte_pfn(pte);
+	}
 
-		} else {
+	if(pte_huge(pte)) {
+		return __handle_huge_cow(vpn, pte);
+	}
+
+	// pte is invalid 
+	if(pte_valid(pte) == false) {
+
+		// not allocated at all
+		if(pte_swapped(pte) == false) {
+			return false;
+		}
+
+		// swapped out; @pfn is the swap slot
+		unsigned int newpfn = __swap_in_page(vpn, pte);
 
-			current->pagetable.outer_ptes[outIndex]->ptes[inIndex].valid = true;
-			mapcounts[pfn]--;
-			alloc_page(vpn, rw);
+		if(newpfn == -1) {
+			return false;
+		}
 
+		// writable again unless another process shares the page
+		if(pte_cow(pte) && mapcounts[newpfn] == 1) {
+			pte_set_flags(pte, PTE_WRITABLE);
 		}
 
+		nr_major_faults++;
+
 		return true;
 	}
 
 	// pte is not writable but @rw is for write
-
-	if((current->pagetable.outer_ptes[outIndex]->ptes[inIndex].writable == false) && 
-		(current->pagetable.outer_ptes[outIndex]->ptes[inIndex].private == 3)) {
+	if((pte_writable(pte) == false) && pte_cow(pte)) {
 
 		if(mapcounts[pfn] == 1) {
 
-			current->pagetable.outer_ptes[outIndex]->ptes[inIndex].writable = true;
+			pte_set_flags(pte, PTE_WRITABLE);
 			
 		} else {
 
-			current->pagetable.outer_ptes[outIndex]->ptes[inIndex].writable = true;
-			mapcounts[pfn]--;
-			alloc_page(vpn, rw);
+			// copy the shared page; keep sharing if out of memory
+			pin_frame(pfn);
+			unsigned int newpfn = alloc_page(vpn, rw);
+			unpin_frame(pfn);
+
+			if(newpfn == -1) {
+				return false;
+			}
+			copy_frame_content(newpfn, pfn);
+			put_page(pfn);
+			remove_rmap(pfn, current, vpn);
+			nr_cow_copies++;
 
 		}
 
+		nr_minor_faults++;
 		return true;
 
 	}
@@ -299,6 +1061,179 @@ bool handle_page_fault(unsigned int vpn, unsigned int rw)
 }
 
 
+/**
+ * A fork in progress. The page table of the parent is walked to the end
+ * even if the page table of the child fails to grow, but nothing is copied
+ * after the failure.
+ */
+struct fork_control {
+	struct process *child;
+	bool failed;
+};
+
+
+/**
+ * __fork_pte(@pte, @vpn, @data)
+ *
+ * DESCRIPTION
+ *   Copy the PTE for @vpn of the current process to the page table of the
+ *   child process of the fork @data.
+ */
+static void __fork_pte(struct pte *pte, unsigned long vpn, void *data)
+{
+	struct fork_control *fc = data;
+	struct process *child = fc->child;
+	struct pte *childpte;
+
+	if(fc->failed) return;
+
+	// huge pages are shared as a whole with a single PTE
+	if(pte_huge(pte)) {
+		childpte = alloc_huge_pte(&child->pagetable, vpn);
+
+		// the empty PTE is skipped when the failed fork is torn down
+		if(childpte == NULL || add_rmap(pte_pfn(pte), child, vpn)) {
+			fc->failed = true;
+			return;
+		}
+
+		if(pte_cow(pte)) {
+			pte_clear_flags(pte, PTE_WRITABLE);
+			free_tlb(vpn);
+		}
+		set_pte(childpte, pte_pfn(pte), pte_flags(pte) & ~(PTE_ACCESSED | PTE_DIRTY));
+
+		__get_huge_page(pte_pfn(pte));
+		return;
+	}
+
+	childpte = alloc_pte(&child->pagetable, vpn);
+
+	if(childpte == NULL) {
+		fc->failed = true;
+		return;
+	}
+
+	// swap entries are shared through the swap slot
+	if(pte_swapped(pte)) {
+		*childpte = *pte;
+		swap_dup(pte_pfn(pte));
+		return;
+	}
+
+	if(pte_valid(pte) == false) return;
+
+	if(add_rmap(pte_pfn(pte), child, vpn)) {
+		fc->failed = true;
+		return;
+	}
+
+	if(pte_cow(pte)) {
+		pte_clear_flags(pte, PTE_WRITABLE);
+
+		// the parent may keep its TLB entries over the fork
+		free_tlb(vpn);
+	}
+
+	// the child starts with clean, unreferenced mappings
+	set_pte(childpte, pte_pfn(pte), pte_flags(pte) & ~(PTE_ACCESSED | PTE_DIRTY));
+
+	get_page(pte_pfn(childpte));
+}
+
+
+/**
+ * __fork_pd(@pde, @vpn, @data)
+ *
+ * DESCRIPTION
+ *   Share the page directory for @vpn of the current process with the child
+ *   process of the fork @data on lazy fork. The directory is copied when it
+ *   is written.
+ */
+static void __fork_pd(struct pt_entry *pde, unsigned long vpn, void *data)
+{
+	struct fork_control *fc = data;
+	struct process *child = fc->child;
+	struct pte_directory *pd = pde->next;
+	struct pt_entry *childpde;
+
+	if(fc->failed) return;
+
+	// huge pages have no page directory to share
+	if(pde->huge) {
+		__fork_pte(&pde->pte, vpn, fc);
+		return;
+	}
+
+	childpde = alloc_pde(&child->pagetable, vpn);
+
+	if(childpde == NULL || !__get_shared_pd(pd)) {
+		fc->failed = true;
+		return;
+	}
+
+	set_pd(&child->pagetable, vpn, pd);
+	childpde->nr_used = pde->nr_used;
+	childpde->shared = true;
+	pde->shared = true;
+}
+
+
+/**
+ * __unfork_pte(@pte, @vpn, @data)/__unfork_pd(@pde, @vpn, @data)
+ *
+ * DESCRIPTION
+ *   Drop the references to the pages, the swap slots, and the shared page
+ *   directories taken for the child process @data by a failed fork.
+ */
+static void __unfork_pte(struct pte *pte, unsigned long vpn, void *data)
+{
+	struct process *child = data;
+	unsigned int pfn = pte_pfn(pte);
+
+	if(pte_swapped(pte)) {
+		swap_free(pfn);
+	} else if(pte_valid(pte)) {
+		if(pte_huge(pte)) {
+			__put_huge_page(pfn);
+		} else {
+			put_page(pfn);
+		}
+		remove_rmap(pfn, child, vpn);
+	}
+}
+
+static void __unfork_pd(struct pt_entry *pde, unsigned long vpn, void *data)
+{
+	if(pde->huge) {
+		__unfork_pte(&pde->pte, vpn, data);
+		return;
+	}
+	__put_shared_pd(pde->next);
+}
+
+
+/**
+ * __unfork(@child)
+ *
+ * DESCRIPTION
+ *   Tear down the child process @child of a failed fork. The pages written
+ *   by the parent are left write-protected, and are made writable again in
+ *   place on the next write as the parent maps them alone.
+ */
+static void __unfork(struct process *child)
+{
+	if(lazy_fork) {
+		for_each_pd(&child->pagetable, __unfork_pd, child);
+	} else {
+		for_each_pte(&child->pagetable, __unfork_pte, child);
+	}
+	free_pagetable(&child->pagetable);
+
+	kmem_cache_free(&process_cache, child);
+}
+
+
 /**
  * switch_process()
  *
@@ -314,8 +1249,8 @@ bool handle_page_fault(unsigned int vpn, unsigned int rw)
  *   the identical page table entry 'values' to its parent's (i.e., @current)
  *   page table. 
  *   To implement the copy-on-write feature, you should manipulate the writable
- *   bit in PTE and mapcounts for shared pages. You may use pte->private for 
- *   storing some useful information :-)
+ *   bit in PTE and mapcounts for shared pages. PTE_COW tells the pages that
+ *   were mapped for writes.
  */
 void switch_process(unsigned int pid)
 {
@@ -325,8 +1260,6 @@ void switch_process(unsigned int pid)
 
 	bool isExist = false;
 
-	flush_tlb();
-
 	list_for_each_entry(temp, &processes, list) {
 		if(temp->pid == pid) {
 			isExist = true;
@@ -350,6 +1283,9 @@ void switch_process(unsigned int pid)
 		list_del_init(&current->list);
 		ptbr = &current->pagetable;
 
+		switch_tlb(current);
+		nr_switches++;
+
 	} else {
 	
 	// Fork a process
@@ -362,40 +1298,43 @@ void switch_process(unsigned int pid)
  			bit in PTE and mapcounts for shared pages.
 	*/
 
-		child = (struct process *)malloc(sizeof(struct process));
-
-		for(int i = 0; i < NR_PTES_PER_PAGE; i++) {
-
-			if(current->pagetable.outer_ptes[i] == NULL) continue;
+		child = kmem_cache_alloc(&process_cache);
 
-			child->pagetable.outer_ptes[i] = (struct pte_directory *)malloc(sizeof(struct pte_directory));
-
-			for(int j = 0; j < NR_PTES_PER_PAGE; j++) {
-
-				if(current->pagetable.outer_ptes[i]->ptes[j].valid == false) continue;
-
-				child->pagetable.outer_ptes[i]->ptes[j].valid = current->pagetable.outer_ptes[i]->ptes[j].valid;
-				child->pagetable.outer_ptes[i]->ptes[j].writable = current->pagetable.outer_ptes[i]->ptes[j].writable;
-				child->pagetable.outer_ptes[i]->ptes[j].pfn = current->pagetable.outer_ptes[i]->ptes[j].pfn;
-				child->pagetable.outer_ptes[i]->ptes[j].private = current->pagetable.outer_ptes[i]->ptes[j].private;
+		if(child == NULL) {
+			return;
+		}
+		child->pid = pid;
 
-				if(current->pagetable.outer_ptes[i]->ptes[j].private == 3) {
-					current->pagetable.outer_ptes[i]->ptes[j].writable = false;
-					child->pagetable.outer_ptes[i]->ptes[j].writable = false;
-				}
+		struct fork_control fc = { .child = child };
+		unsigned long nr_visits = nr_pt_visits;
 
-				mapcounts[child->pagetable.outer_ptes[i]->ptes[j].pfn]++;
+		if(lazy_fork) {
+			for_each_pd(&current->pagetable, __fork_pd, &fc);
+		} else {
+			for_each_pte(&current->pagetable, __fork_pte, &fc);
+		}
+		nr_fork_pt_visits += nr_pt_visits - nr_visits;
 
-			}
+		// the parent goes on alone if the page table of the child cannot grow
+		if(fc.failed) {
+			__unfork(child);
+			return;
+		}
+		nr_forks++;
 
+		// the parent may write to the shared directories through its
+		// TLB entries otherwise. switch_tlb() flushes an untagged TLB
+		if(lazy_fork && nr_asids) {
+			flush_tlb_of(current);
 		}
 
 		list_add_tail(&current->list, &processes);
-		child->pid = pid;
 
 		current = child;
 		ptbr = &current->pagetable;
 
+		switch_tlb(current);
+
 	}
 }
 
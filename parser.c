@@ -13,40 +13,117 @@
  *
  **********************************************************************/
 
-#include <string.h>
+#include <stdlib.h>
 #include <ctype.h>
+#include <errno.h>
+#include <inttypes.h>
 
 #include "types.h"
+#include "list_head.h"
+#include "vm.h"
 #include "parser.h"
 
-int parse_command(char *command, int *nr_tokens, char *tokens[])
+int scan_command(const char **pos, const char *end, int *nr_tokens, struct token tokens[])
 {
-	char *curr = command;
-	int token_started = false;
+	const char *curr = *pos;
+	bool comment = false;
+
 	*nr_tokens = 0;
 
-	while (*curr != '\0') {
+	if (curr >= end) return 0;
+
+	while (curr < end && *curr != '\n') {
+		const char *start;
+
 		if (isspace(*curr)) {
-			*curr = '\0';
-			token_started = false;
-		} else {
-			if (!token_started) {
-				tokens[*nr_tokens] = curr;
-				*nr_tokens += 1;
-				token_started = true;
-			}
+			curr++;
+			continue;
 		}
 
-		curr++;
+		start = curr;
+		while (curr < end && !isspace(*curr)) curr++;
+
+		if (comment) continue;
+
+		if (*start == '#') {
+			comment = true;
+			continue;
+		}
+
+		if (*nr_tokens < MAX_NR_TOKENS) {
+			tokens[*nr_tokens].str = start;
+			tokens[*nr_tokens].len = curr - start;
+		}
+		*nr_tokens += 1;
 	}
 
-	for (int i = 0; i < *nr_tokens; i++) {
-		if (strncmp(tokens[i], "#", strlen("#")) == 0) {
-			*nr_tokens = i;
-			tokens[i] = NULL;
-			break;
+	*pos = curr < end ? curr + 1 : end;
+
+	return 1;
+}
+
+static inline int __digit_value(char c)
+{
+	if (c >= '0' && c <= '9') return c - '0';
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+	return 16;
+}
+
+unsigned long token_to_ulong(const struct token *token)
+{
+	const char *c = token->str;
+	const char *end = token->str + token->len;
+	unsigned long value = 0;
+	unsigned int base = 10;
+	bool negative = false;
+
+	if (c < end && (*c == '-' || *c == '+')) {
+		negative = (*c == '-');
+		c++;
+	}
+
+	if (c < end && *c == '0') {
+		base = 8;
+		if (end - c > 2 && (c[1] == 'x' || c[1] == 'X') && __digit_value(c[2]) < 16) {
+			base = 16;
+			c += 2;
+		}
+	}
+
+	for (; c < end && __digit_value(*c) < base; c++) {
+		value = value * base + __digit_value(*c);
+	}
+
+	return negative ? -value : value;
+}
+
+unsigned int token_to_rwflag(const struct token *token)
+{
+	unsigned int rwflag = 0;
+
+	for (unsigned int i = 0; i < token->len; i++) {
+		if (token->str[i] == 'r' || token->str[i] == 'R') {
+			rwflag |= RW_READ;
+		}
+		if (token->str[i] == 'w' || token->str[i] == 'W') {
+			rwflag |= RW_WRITE;
 		}
 	}
+	return rwflag;
+}
+
+int parse_ulong(const char *str, unsigned long max, unsigned long *result)
+{
+	char *end;
+	uintmax_t v;
+
+	if (!isdigit((unsigned char)str[0])) return -1;
+
+	errno = 0;
+	v = strtoumax(str, &end, 0);
+	if (*end || errno || v > max) return -1;
 
-	return (*nr_tokens > 0);
+	*result = v;
+	return 0;
 }
@@ -16,35 +16,100 @@
 #ifndef __PARSER_H__
 #define __PARSER_H__
 
+#include "types.h"
+
 #define MAX_NR_TOKENS	32	/* Maximum length of tokens in a command */
 #define MAX_TOKEN_LEN	128	/* Maximum length of single token */
 #define MAX_COMMAND_LEN	4096 /* Maximum length of assembly string */
 
+/**
+ * A token points into the input without copying it, and is not terminated
+ * with NUL.
+ */
+struct token {
+	const char *str;
+	unsigned int len;
+};
+
 
 /***********************************************************************
- * parse_command()
+ * scan_command()
  *
  * DESCRIPTION
- *  Parse @command, and put each command token into @tokens[] and the number of
- *  tokes into @nr_tokens. You may use this implemention or your own from PA0.
+ *  Scan the command line starting at *@pos in a single pass, and put each
+ *  command token into @tokens[] and the number of tokens into @nr_tokens.
+ *  The line ends at a newline or at @end, and *@pos is advanced to the
+ *  next line. The input is not modified.
  *
  *  A command token is defined as a string without any whitespace (i.e., *space*
- *  and *tab* in this programming assignment). For exmaple,
- *   command = "  cp  -pr /home/sslab   /path/to/dest  "
+ *  and *tab* in this programming assignment). A token starting with '#' starts
+ *  a comment running to the end of the line. For exmaple,
+ *   command = "  cp  -pr /home/sslab   /path/to/dest  # copy"
  *
  *  then, nr_tokens = 4, and tokens is
  *    tokens[0] = "cp"
  *    tokens[1] = "-pr"
  *    tokens[2] = "/home/sslab"
  *    tokens[3] = "/path/to/dest"
- *    tokens[>=4] = NULL
  *
+ *  Tokens beyond MAX_NR_TOKENS are counted but not stored.
  *
  * RETURN VALUE
- *  Return 1 if @nr_tokens > 0
- *  Return 0 otherwise
+ *  Return 1 if a line is scanned
+ *  Return 0 if *@pos is at @end
+ *
+ */
+int scan_command(const char **pos, const char *end, int *nr_tokens, struct token tokens[]);
+
+/**
+ * token_is(@token, @word)
+ *
+ * RETURN
+ *   @true if @token is @word, ignoring the case
+ */
+static inline bool token_is(const struct token *token, const char *word)
+{
+	unsigned int i;
+
+	for (i = 0; i < token->len; i++) {
+		char c = token->str[i];
+
+		if (c >= 'A' && c <= 'Z') c += 'a' - 'A';
+		if (c != word[i]) return false;
+	}
+	return word[i] == '\0';
+}
+
+/**
+ * token_to_ulong(@token)
+ *
+ * DESCRIPTION
+ *   Convert the leading number in @token as strtoimax() does with base 0.
+ *   That is, "0x" prefixes a hexadecimal number, and "0" an octal one.
+ */
+unsigned long token_to_ulong(const struct token *token);
+
+/**
+ * token_to_rwflag(@token)
+ *
+ * RETURN
+ *   The access flags for the 'r' and 'w' characters in @token, such as
+ *   RW_READ | RW_WRITE for "rw"
+ */
+unsigned int token_to_rwflag(const struct token *token);
+
+/**
+ * parse_ulong(@str, @max, @result)
+ *
+ * DESCRIPTION
+ *   Convert @str, which should be a plain number up to @max, into @result.
+ *   Signs, leading spaces, and trailing garbage are rejected rather than
+ *   read as 0 or wrapped around.
  *
+ * RETURN
+ *   0 on success
+ *   -1 if @str is not such a number
  */
-int parse_command(char *command, int *nr_tokens, char *tokens[]);
+int parse_ulong(const char *str, unsigned long max, unsigned long *result);
 
 #endif
@@ -0,0 +1,557 @@
+/**********************************************************************
+ * Copyright (c) 2020-2021
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "types.h"
+#include "list_head.h"
+#include "vm.h"
+#include "frame.h"
+#include "slab.h"
+#include "pgtable.h"
+
+enum pt_format pt_format = PT_RADIX;
+unsigned int pt_levels = NR_PT_LEVELS;
+unsigned int pt_bits = PTES_PER_PAGE_SHIFT;
+unsigned long nr_pt_visits = 0;
+
+unsigned int hpt_shift = 0;
+struct hpte **hpt_anchors = NULL;
+unsigned int hpt_nr_entries = 0;
+
+int set_pt_format(const char *name)
+{
+	if (strcmp(name, "radix") == 0) {
+		pt_format = PT_RADIX;
+	} else if (strcmp(name, "hashed") == 0) {
+		pt_format = PT_HASHED;
+	} else {
+		fprintf(stderr, "Unknown page table format %s\n", name);
+		return -1;
+	}
+	return 0;
+}
+
+int init_pagetable(void)
+{
+	if (pt_levels < 2 || pt_bits < 1 || nr_vpn_bits() > MAX_VPN_BITS) {
+		fprintf(stderr, "The page table should have 2 or more levels of "
+				"1 or more bits, and translate up to %d-bit VPNs\n",
+				MAX_VPN_BITS);
+		return -1;
+	}
+
+	pte_directory_cache.size = sizeof(struct pte) << pt_bits;
+	pt_node_cache.size = sizeof(struct pt_entry) << pt_bits;
+
+	if (pt_format == PT_HASHED) {
+		/* Keep the chains short with twice as many anchors as frames */
+		for (hpt_shift = 1; (1UL << hpt_shift) < 2UL * nr_pageframes; hpt_shift++)
+			;
+		hpt_anchors = calloc(1UL << hpt_shift, sizeof(*hpt_anchors));
+		if (!hpt_anchors) {
+			fprintf(stderr, "Unable to allocate the hash anchors\n");
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+unsigned int pagetable_id(struct pagetable *pt)
+{
+	static unsigned int last_id = 0;
+
+	if (!pt->id) pt->id = ++last_id;
+
+	return pt->id;
+}
+
+/**
+ * __lookup_hpte(@pt, @vpn, @pprev)
+ *
+ * DESCRIPTION
+ *   Find the hashed page table entry for @vpn in @pt. @pprev is set to the
+ *   link pointing to the entry if it is not NULL.
+ *
+ * RETURN
+ *   The entry for @vpn
+ *   NULL if not found
+ */
+static struct hpte *__lookup_hpte(struct pagetable *pt, unsigned long vpn, struct hpte ***pprev)
+{
+	unsigned int id = pagetable_id(pt);
+	struct hpte **link = &hpt_anchors[hpt_hash(id, vpn)];
+
+	for (; *link; link = &(*link)->next) {
+		if ((*link)->id == id && (*link)->vpn == vpn) {
+			if (pprev) *pprev = link;
+			return *link;
+		}
+	}
+	return NULL;
+}
+
+static struct hpte *__alloc_hpte(struct pagetable *pt, unsigned long vpn)
+{
+	unsigned int id = pagetable_id(pt);
+	struct hpte **anchor = &hpt_anchors[hpt_hash(id, vpn)];
+	struct hpte *h = kmem_cache_alloc(&hpte_cache);
+
+	if (!h) return NULL;
+
+	h->vpn = vpn;
+	h->id = id;
+	h->next = *anchor;
+	*anchor = h;
+	hpt_nr_entries++;
+
+	return h;
+}
+
+static int __compare_hpte(const void *a, const void *b)
+{
+	const struct hpte *x = *(struct hpte * const *)a;
+	const struct hpte *y = *(struct hpte * const *)b;
+
+	return (x->vpn > y->vpn) - (x->vpn < y->vpn);
+}
+
+/**
+ * The hashed page table is not ordered by VPN. Collect the entries of @pt
+ * from the whole table, and sort them before visiting.
+ */
+static void __for_each_hpte(struct pagetable *pt, pte_fn fn, void *data)
+{
+	unsigned int id = pagetable_id(pt);
+	struct hpte **entries;
+	unsigned int nr_entries = 0;
+
+	if (!hpt_nr_entries) return;
+
+	entries = malloc(sizeof(*entries) * hpt_nr_entries);
+	assert(entries);
+
+	for (unsigned long i = 0; i < (1UL << hpt_shift); i++) {
+		nr_pt_visits++;
+		for (struct hpte *h = hpt_anchors[i]; h; h = h->next) {
+			nr_pt_visits++;
+			if (h->id == id) entries[nr_entries++] = h;
+		}
+	}
+	qsort(entries, nr_entries, sizeof(*entries), __compare_hpte);
+
+	for (unsigned int i = 0; i < nr_entries; i++) {
+		fn(&entries[i]->pte, entries[i]->vpn, data);
+	}
+	free(entries);
+}
+
+/**
+ * __walk_pde(@pt, @vpn, @path)
+ *
+ * DESCRIPTION
+ *   Walk the upper level nodes of @pt for @vpn, and record the entries
+ *   visited at each level to @path if it is not NULL.
+ *
+ * RETURN
+ *   The entry pointing to the page directory covering @vpn
+ *   NULL if a node on the way does not exist
+ */
+static struct pt_entry *__walk_pde(struct pagetable *pt, unsigned long vpn, struct pt_entry **path)
+{
+	struct pt_node *node = pt->root;
+	struct pt_entry *pde = NULL;
+
+	for (unsigned int level = 0; level < pt_levels - 1; level++) {
+		if (!node) return NULL;
+
+		pde = &node->entries[pt_index(vpn, level)];
+		if (path) path[level] = pde;
+
+		node = pde->next;
+	}
+	return pde;
+}
+
+struct pt_entry *lookup_pd(struct pagetable *pt, unsigned long vpn)
+{
+	struct pt_entry *pde = __walk_pde(pt, vpn, NULL);
+
+	if (!pde || !pde->next) return NULL;
+
+	return pde;
+}
+
+struct pte *lookup_pte(struct pagetable *pt, unsigned long vpn)
+{
+	struct pt_entry *pde;
+
+	if (pt_format == PT_HASHED) {
+		struct hpte *h = __lookup_hpte(pt, vpn, NULL);
+
+		return h ? &h->pte : NULL;
+	}
+
+	pde = __walk_pde(pt, vpn, NULL);
+	if (pde && pde->huge) return &pde->pte;
+
+	pde = lookup_pd(pt, vpn);
+
+	return pde ? pd_pte(pde, vpn) : NULL;
+}
+
+struct pte *alloc_pte(struct pagetable *pt, unsigned long vpn)
+{
+	struct pt_entry *pde;
+	struct pte *pte;
+
+	if (pt_format == PT_HASHED) {
+		struct hpte *h = __lookup_hpte(pt, vpn, NULL);
+
+		if (!h) h = __alloc_hpte(pt, vpn);
+
+		return h ? &h->pte : NULL;
+	}
+
+	pde = alloc_pd(pt, vpn);
+	if (!pde) return NULL;
+
+	pte = pd_pte(pde, vpn);
+	if (pte_none(pte)) pde->nr_used++;
+
+	return pte;
+}
+
+bool put_pte(struct pagetable *pt, unsigned long vpn)
+{
+	struct pt_entry *pde;
+
+	if (pt_format == PT_HASHED) {
+		struct hpte **link;
+		struct hpte *h = __lookup_hpte(pt, vpn, &link);
+
+		assert(h && pte_none(&h->pte));
+
+		*link = h->next;
+		kmem_cache_free(&hpte_cache, h);
+		hpt_nr_entries--;
+
+		return false;
+	}
+
+	pde = lookup_pd(pt, vpn);
+	assert(pde && pte_none(pd_pte(pde, vpn)));
+
+	if (--pde->nr_used > 0) return false;
+
+	release_pd(pt, vpn);
+	return true;
+}
+
+struct pt_entry *alloc_pde(struct pagetable *pt, unsigned long vpn)
+{
+	struct pt_entry *parent = NULL;
+	struct pt_entry *pde = NULL;
+	struct pt_node *node;
+
+	if (!pt->root) {
+		pt->root = kmem_cache_alloc(&pt_node_cache);
+		if (!pt->root) return NULL;
+	}
+	node = pt->root;
+
+	for (unsigned int level = 0; level < pt_levels - 1; level++) {
+		if (!node) {
+			node = kmem_cache_alloc(&pt_node_cache);
+			if (!node) return NULL;
+
+			pde->next = node;
+			pde->nr_used = 0;
+
+			/* The entries in the root node are not counted */
+			if (parent) parent->nr_used++;
+		}
+		parent = pde;
+		pde = &node->entries[pt_index(vpn, level)];
+		node = pde->next;
+	}
+	return pde;
+}
+
+struct pt_entry *alloc_pd(struct pagetable *pt, unsigned long vpn)
+{
+	struct pt_entry *pde = alloc_pde(pt, vpn);
+	struct pte_directory *pd;
+
+	if (!pde || pde->huge) return NULL;
+	if (pde->next) return pde;
+
+	pd = kmem_cache_alloc(&pte_directory_cache);
+	if (!pd) return NULL;
+
+	set_pd(pt, vpn, pd);
+	return pde;
+}
+
+void set_pd(struct pagetable *pt, unsigned long vpn, struct pte_directory *pd)
+{
+	struct pt_entry *path[MAX_VPN_BITS];
+	struct pt_entry *pde = __walk_pde(pt, vpn, path);
+
+	assert(pde && !pde->next && !pde->huge);
+
+	pde->next = pd;
+	pde->nr_used = 0;
+	pde->shared = false;
+
+	if (pt_levels > 2) path[pt_levels - 3]->nr_used++;
+}
+
+/* Free the nodes on @path left empty, leaving the root node alone */
+static void __release_path(struct pt_entry **path)
+{
+	for (int level = pt_levels - 2; level > 0; level--) {
+		struct pt_entry *parent = path[level - 1];
+
+		if (--parent->nr_used > 0) break;
+
+		kmem_cache_free(&pt_node_cache, parent->next);
+		parent->next = NULL;
+	}
+}
+
+void release_pd(struct pagetable *pt, unsigned long vpn)
+{
+	struct pt_entry *path[MAX_VPN_BITS];
+	struct pt_entry *pde = __walk_pde(pt, vpn, path);
+
+	assert(pde && pde->next && pde->nr_used == 0);
+
+	if (!pde->shared) {
+		kmem_cache_free(&pte_directory_cache, pde->next);
+	}
+	pde->next = NULL;
+	pde->shared = false;
+
+	__release_path(path);
+}
+
+struct pte *alloc_huge_pte(struct pagetable *pt, unsigned long vpn)
+{
+	struct pt_entry *path[MAX_VPN_BITS];
+	struct pt_entry *pde;
+
+	if (!alloc_pde(pt, vpn)) return NULL;
+
+	pde = __walk_pde(pt, vpn, path);
+	if (pde->next || pde->huge) return NULL;
+
+	pde->huge = true;
+	clear_pte(&pde->pte);
+
+	if (pt_levels > 2) path[pt_levels - 3]->nr_used++;
+
+	return &pde->pte;
+}
+
+void release_huge_pte(struct pagetable *pt, unsigned long vpn)
+{
+	struct pt_entry *path[MAX_VPN_BITS];
+	struct pt_entry *pde = __walk_pde(pt, vpn, path);
+
+	assert(pde && pde->huge);
+
+	pde->huge = false;
+	pde->nr_used = 0;
+
+	__release_path(path);
+}
+
+struct pte *collapse_pd(struct pagetable *pt, unsigned long vpn)
+{
+	struct pt_entry *pde = lookup_pd(pt, vpn);
+
+	assert(pde && !pde->shared);
+
+	/* The entry stays counted in the upper level as the huge page */
+	kmem_cache_free(&pte_directory_cache, pde->next);
+	pde->next = NULL;
+	pde->huge = true;
+	clear_pte(&pde->pte);
+
+	return &pde->pte;
+}
+
+struct pt_entry *split_huge_pte(struct pagetable *pt, unsigned long vpn)
+{
+	struct pt_entry *pde = __walk_pde(pt, vpn, NULL);
+	struct pte_directory *pd;
+	struct pte huge;
+
+	assert(pde && pde->huge);
+
+	pd = kmem_cache_alloc(&pte_directory_cache);
+	if (!pd) return NULL;
+
+	huge = pde->pte;
+	for (unsigned long i = 0; i < (1UL << pt_bits); i++) {
+		set_pte(&pd->ptes[i], pte_pfn(&huge) + i,
+				pte_flags(&huge) & ~(PTE_HUGE | PTE_THP));
+	}
+
+	pde->huge = false;
+	pde->next = pd;
+	pde->nr_used = 1U << pt_bits;
+	pde->shared = false;
+
+	return pde;
+}
+
+static void __for_each_pd(struct pt_node *node, unsigned int level,
+		unsigned long vpn, pd_fn fn, void *data)
+{
+	unsigned int shift = pt_bits * (pt_levels - 1 - level);
+
+	for (unsigned long i = 0; i < (1UL << pt_bits); i++) {
+		struct pt_entry *pde = &node->entries[i];
+
+		nr_pt_visits++;
+		if (!pde->next && !pde->huge) continue;
+
+		if (level == pt_levels - 2) {
+			fn(pde, vpn | (i << shift), data);
+		} else {
+			__for_each_pd(pde->next, level + 1, vpn | (i << shift), fn, data);
+		}
+	}
+}
+
+void for_each_pd(struct pagetable *pt, pd_fn fn, void *data)
+{
+	if (!pt->root) return;
+
+	__for_each_pd(pt->root, 0, 0, fn, data);
+}
+
+struct pte_walk {
+	pte_fn fn;
+	void *data;
+};
+
+static void __for_each_pte_in_pd(struct pt_entry *pde, unsigned long vpn, void *data)
+{
+	struct pte_walk *w = data;
+
+	if (pde->huge) {
+		w->fn(&pde->pte, vpn, w->data);
+		return;
+	}
+
+	for (unsigned long i = 0; i < (1UL << pt_bits); i++) {
+		struct pte *pte = pd_pte(pde, vpn + i);
+
+		nr_pt_visits++;
+		if (pte_none(pte)) continue;
+
+		w->fn(pte, vpn + i, w->data);
+	}
+}
+
+void for_each_pte(struct pagetable *pt, pte_fn fn, void *data)
+{
+	struct pte_walk w = { .fn = fn, .data = data };
+
+	if (pt_format == PT_HASHED) {
+		__for_each_hpte(pt, fn, data);
+		return;
+	}
+	for_each_pd(pt, __for_each_pte_in_pd, &w);
+}
+
+static void __free_pt_node(struct pt_node *node, unsigned int level)
+{
+	for (unsigned long i = 0; i < (1UL << pt_bits); i++) {
+		struct pt_entry *pde = &node->entries[i];
+
+		if (!pde->next) continue;
+
+		if (level < pt_levels - 2) {
+			__free_pt_node(pde->next, level + 1);
+		} else if (!pde->shared) {
+			kmem_cache_free(&pte_directory_cache, pde->next);
+		}
+	}
+	kmem_cache_free(&pt_node_cache, node);
+}
+
+void free_pagetable(struct pagetable *pt)
+{
+	if (pt_format == PT_HASHED) {
+		unsigned int id = pagetable_id(pt);
+
+		for (unsigned long i = 0; i < (1UL << hpt_shift); i++) {
+			struct hpte **link = &hpt_anchors[i];
+
+			while (*link) {
+				struct hpte *h = *link;
+
+				if (h->id != id) {
+					link = &h->next;
+					continue;
+				}
+				*link = h->next;
+				kmem_cache_free(&hpte_cache, h);
+				hpt_nr_entries--;
+			}
+		}
+		return;
+	}
+
+	if (!pt->root) return;
+
+	__free_pt_node(pt->root, 0);
+	pt->root = NULL;
+}
+
+static void __count_pt_nodes(struct pt_node *node, unsigned int level,
+		unsigned int *nr_nodes, unsigned int *nr_pds)
+{
+	(*nr_nodes)++;
+
+	for (unsigned long i = 0; i < (1UL << pt_bits); i++) {
+		struct pt_entry *pde = &node->entries[i];
+
+		if (!pde->next) continue;
+
+		if (level == pt_levels - 2) {
+			(*nr_pds)++;
+		} else {
+			__count_pt_nodes(pde->next, level + 1, nr_nodes, nr_pds);
+		}
+	}
+}
+
+void count_pt_nodes(struct pagetable *pt, unsigned int *nr_nodes, unsigned int *nr_pds)
+{
+	*nr_nodes = *nr_pds = 0;
+
+	if (!pt->root) return;
+
+	__count_pt_nodes(pt->root, 0, nr_nodes, nr_pds);
+}
@@ -0,0 +1,309 @@
+/**********************************************************************
+ * Copyright (c) 2020-2021
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+#ifndef __PGTABLE_H__
+#define __PGTABLE_H__
+
+#include "types.h"
+
+/* The widest VPN the page table can translate */
+#define MAX_VPN_BITS	48
+
+/**
+ * Page table formats. The radix page table is a tree of @pt_levels levels.
+ * The hashed page table is a single table shared by all processes, which
+ * holds the PTEs in use only. Its entries are chained from the hash anchors
+ * by (page table, VPN), and the number of anchors scales with the physical memory
+ * like an inverted page table.
+ */
+enum pt_format {
+	PT_RADIX,
+	PT_HASHED,
+};
+extern enum pt_format pt_format;
+
+/**
+ * Shape of the page table, which can be set before init_pagetable(). A VPN is
+ * split into @pt_levels indices of @pt_bits bits each, from the most
+ * significant one indexing the root node. The hashed page table takes
+ * @pt_levels * @pt_bits bits of VPNs as well.
+ */
+extern unsigned int pt_levels;
+extern unsigned int pt_bits;
+
+/**
+ * The number of page table entries visited by for_each_pte() and
+ * for_each_pd(), which tells the cost of walking the whole page table
+ */
+extern unsigned long nr_pt_visits;
+
+static inline unsigned int nr_vpn_bits(void)
+{
+	return pt_levels * pt_bits;
+}
+
+/* A huge page is as large as the pages covered by a page directory */
+static inline unsigned long pages_per_huge_page(void)
+{
+	return 1UL << pt_bits;
+}
+
+static inline unsigned int pt_index(unsigned long vpn, unsigned int level)
+{
+	return (vpn >> (pt_bits * (pt_levels - 1 - level))) & ((1UL << pt_bits) - 1);
+}
+
+/* Index of the page directory covering @vpn, which tags the page-walk cache */
+static inline unsigned long pd_index(unsigned long vpn)
+{
+	return vpn >> pt_bits;
+}
+
+static inline unsigned int pte_index(unsigned long vpn)
+{
+	return vpn & ((1UL << pt_bits) - 1);
+}
+
+static inline struct pte *pd_pte(struct pt_entry *pde, unsigned long vpn)
+{
+	return &((struct pte_directory *)pde->next)->ptes[pte_index(vpn)];
+}
+
+/**
+ * set_pt_format(@name)
+ *
+ * RETURN
+ *   0 on success
+ *   -1 if @name is not a known format
+ */
+int set_pt_format(const char *name);
+
+/**
+ * init_pagetable()
+ *
+ * DESCRIPTION
+ *   Check the shape of the page table, and size the page table nodes or the
+ *   hash anchors. Should be called after @nr_pageframes is set.
+ *
+ * RETURN
+ *   0 on success
+ *   -1 if the shape is not supported
+ */
+int init_pagetable(void);
+
+/**
+ * lookup_pte(@pt, @vpn)
+ *
+ * RETURN
+ *   The PTE for @vpn in @pt, which is the PTE of the huge page if @vpn is
+ *   mapped to a huge page
+ *   NULL if the PTE does not exist
+ */
+struct pte *lookup_pte(struct pagetable *pt, unsigned long vpn);
+
+/**
+ * alloc_pte(@pt, @vpn)
+ *
+ * DESCRIPTION
+ *   Get the PTE for @vpn in @pt, allocating the page table space for it if
+ *   necessary. An empty PTE is accounted as in use, so the caller should
+ *   populate it.
+ *
+ * RETURN
+ *   The PTE for @vpn
+ *   NULL if unable to allocate the page table space
+ */
+struct pte *alloc_pte(struct pagetable *pt, unsigned long vpn);
+
+/**
+ * put_pte(@pt, @vpn)
+ *
+ * DESCRIPTION
+ *   Release the page table space for the PTE for @vpn, which has been
+ *   cleared by the caller.
+ *
+ * RETURN
+ *   @true if the page directory covering @vpn is released along
+ *   @false otherwise
+ */
+bool put_pte(struct pagetable *pt, unsigned long vpn);
+
+/**
+ * for_each_pte(@pt, @fn, @data)
+ *
+ * DESCRIPTION
+ *   Call @fn for the valid or swapped PTEs of @pt in the VPN order. A huge
+ *   page is visited once with its first VPN.
+ */
+typedef void (*pte_fn)(struct pte *pte, unsigned long vpn, void *data);
+void for_each_pte(struct pagetable *pt, pte_fn fn, void *data);
+
+/**
+ * Hashed page table. The entries are chained from @hpt_anchors, which has
+ * 2^@hpt_shift slots, twice as many as the page frames at least.
+ */
+struct hpte {
+	unsigned long vpn;
+	unsigned int id;	/* @id of the page table */
+	struct pte pte;
+	struct hpte *next;	/* The next entry in the chain */
+};
+
+extern unsigned int hpt_shift;
+extern struct hpte **hpt_anchors;
+extern unsigned int hpt_nr_entries;
+
+static inline unsigned int hpt_hash(unsigned int id, unsigned long vpn)
+{
+	unsigned long key = vpn ^ ((unsigned long)id << MAX_VPN_BITS);
+
+	return (key * 0x9e3779b97f4a7c15UL) >> (64 - hpt_shift);
+}
+
+/**
+ * pagetable_id(@pt)
+ *
+ * RETURN
+ *   The tag of @pt in the hashed page table. Processes may have the same
+ *   PID, so the page tables are numbered when they are first used.
+ */
+unsigned int pagetable_id(struct pagetable *pt);
+
+/**
+ * Radix page table only
+ *
+ * lookup_pd(@pt, @vpn)
+ *
+ * RETURN
+ *   The entry pointing to the page directory covering @vpn in @pt
+ *   NULL if the page directory does not exist
+ */
+struct pt_entry *lookup_pd(struct pagetable *pt, unsigned long vpn);
+
+/**
+ * alloc_pde(@pt, @vpn)
+ *
+ * DESCRIPTION
+ *   Populate the upper level nodes of @pt down to the entry pointing to the
+ *   page directory covering @vpn. The page directory itself is not allocated,
+ *   and the entry should be set with set_pd().
+ *
+ * RETURN
+ *   The entry pointing to the page directory
+ *   NULL if unable to allocate the nodes
+ */
+struct pt_entry *alloc_pde(struct pagetable *pt, unsigned long vpn);
+
+/**
+ * alloc_pd(@pt, @vpn)
+ *
+ * DESCRIPTION
+ *   Same as alloc_pde() but also allocate an empty page directory if there is
+ *   no page directory covering @vpn.
+ */
+struct pt_entry *alloc_pd(struct pagetable *pt, unsigned long vpn);
+
+/**
+ * set_pd(@pt, @vpn, @pd)
+ *
+ * DESCRIPTION
+ *   Point the empty entry for the page directory covering @vpn to @pd. The
+ *   entry should have been populated by alloc_pde().
+ */
+void set_pd(struct pagetable *pt, unsigned long vpn, struct pte_directory *pd);
+
+/**
+ * release_pd(@pt, @vpn)
+ *
+ * DESCRIPTION
+ *   Detach the page directory covering @vpn from @pt, and free the upper level
+ *   nodes left empty. The page directory itself is freed unless it is shared.
+ *   The caller should make sure that the page directory has no valid or
+ *   swapped PTE.
+ */
+void release_pd(struct pagetable *pt, unsigned long vpn);
+
+/**
+ * alloc_huge_pte(@pt, @vpn)/release_huge_pte(@pt, @vpn)
+ *
+ * DESCRIPTION
+ *   Turn the entry for the page directory covering @vpn into the PTE of a
+ *   huge page, and back to an empty entry. The caller should populate the
+ *   PTE with PTE_HUGE, and clear it before releasing.
+ *
+ * RETURN
+ *   The empty PTE for the huge page
+ *   NULL if the range is in use or unable to allocate the upper levels
+ */
+struct pte *alloc_huge_pte(struct pagetable *pt, unsigned long vpn);
+void release_huge_pte(struct pagetable *pt, unsigned long vpn);
+
+/**
+ * collapse_pd(@pt, @vpn)
+ *
+ * DESCRIPTION
+ *   Free the page directory covering @vpn in @pt, and turn the entry
+ *   pointing to it into the PTE of a huge page. The caller should have
+ *   released the pages mapped by the directory, and should populate the PTE
+ *   with PTE_HUGE. The directory should not be shared.
+ *
+ * RETURN
+ *   The empty PTE for the huge page
+ */
+struct pte *collapse_pd(struct pagetable *pt, unsigned long vpn);
+
+/**
+ * split_huge_pte(@pt, @vpn)
+ *
+ * DESCRIPTION
+ *   Replace the PTE of the huge page covering @vpn in @pt with a page
+ *   directory mapping the same page frames page by page with the same flags.
+ *
+ * RETURN
+ *   The entry pointing to the new page directory
+ *   NULL if unable to allocate the page directory
+ */
+struct pt_entry *split_huge_pte(struct pagetable *pt, unsigned long vpn);
+
+/**
+ * for_each_pd(@pt, @fn, @data)
+ *
+ * DESCRIPTION
+ *   Call @fn for the entries of @pt pointing to page directories or mapping
+ *   huge pages in the VPN order. @vpn is the first VPN covered by the entry.
+ */
+typedef void (*pd_fn)(struct pt_entry *pde, unsigned long vpn, void *data);
+void for_each_pd(struct pagetable *pt, pd_fn fn, void *data);
+
+/**
+ * free_pagetable(@pt)
+ *
+ * DESCRIPTION
+ *   Free all the nodes, the page directories, and the hashed page table
+ *   entries of @pt regardless of their PTEs, leaving @pt empty. The page
+ *   directories shared with other page tables are not freed. The caller
+ *   should have released the pages and the swap slots mapped by @pt.
+ */
+void free_pagetable(struct pagetable *pt);
+
+/**
+ * count_pt_nodes(@pt, @nr_nodes, @nr_pds)
+ *
+ * DESCRIPTION
+ *   Count the upper level nodes including the root node, and the page
+ *   directories of @pt.
+ */
+void count_pt_nodes(struct pagetable *pt, unsigned int *nr_nodes, unsigned int *nr_pds);
+
+#endif
@@ -0,0 +1,94 @@
+/**********************************************************************
+ * Copyright (c) 2020-2021
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "types.h"
+#include "list_head.h"
+#include "vm.h"
+#include "slab.h"
+#include "pgtable.h"
+
+struct kmem_cache pte_directory_cache = KMEM_CACHE("pte_directory", struct pte_directory);
+struct kmem_cache process_cache = KMEM_CACHE("process", struct process);
+
+/* Page table nodes are sized by init_pagetable() */
+struct kmem_cache pt_node_cache = KMEM_CACHE("pt_node", struct pt_node);
+
+struct kmem_cache hpte_cache = KMEM_CACHE("hpte", struct hpte);
+
+static int __grow_cache(struct kmem_cache *cache)
+{
+	char *slab;
+
+	if (!cache->objsize) {
+		cache->objsize = (cache->size + SLAB_ALIGN - 1) & ~((size_t)SLAB_ALIGN - 1);
+		cache->objs_per_slab = SLAB_NR_OBJECTS;
+		while (cache->objs_per_slab > 1 &&
+				cache->objsize * cache->objs_per_slab > SLAB_MAX_SIZE) {
+			cache->objs_per_slab /= 2;
+		}
+	}
+
+	if (posix_memalign((void **)&slab, SLAB_ALIGN, cache->objsize * cache->objs_per_slab)) {
+		return -1;
+	}
+
+	/* Chain the objects in the address order */
+	for (int i = cache->objs_per_slab - 1; i >= 0; i--) {
+		void *obj = slab + cache->objsize * i;
+
+		*(void **)obj = cache->freelist;
+		cache->freelist = obj;
+	}
+
+	cache->nr_slabs++;
+	cache->nr_objs += cache->objs_per_slab;
+
+	return 0;
+}
+
+void *kmem_cache_alloc(struct kmem_cache *cache)
+{
+	void *obj;
+
+	if (!cache->freelist && __grow_cache(cache)) {
+		return NULL;
+	}
+
+	obj = cache->freelist;
+	cache->freelist = *(void **)obj;
+
+	cache->nr_active++;
+	cache->nr_allocs++;
+
+	memset(obj, 0x00, cache->size);
+	return obj;
+}
+
+void kmem_cache_free(struct kmem_cache *cache, void *obj)
+{
+	if (!obj) return;
+
+	assert(cache->nr_active > 0);
+
+	*(void **)obj = cache->freelist;
+	cache->freelist = obj;
+
+	cache->nr_active--;
+	cache->nr_frees++;
+}
@@ -0,0 +1,80 @@
+/**********************************************************************
+ * Copyright (c) 2020-2021
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+#ifndef __SLAB_H__
+#define __SLAB_H__
+
+#include <stddef.h>
+
+#include "types.h"
+
+/* Objects are aligned to the cache line size */
+#define SLAB_ALIGN	64
+
+/* The number of objects preallocated at once when a cache runs out. Large
+ * objects are preallocated fewer at once to keep slabs within SLAB_MAX_SIZE */
+#define SLAB_NR_OBJECTS	64
+#define SLAB_MAX_SIZE	(1 << 20)
+
+/**
+ * Object cache. Objects are carved out of slabs holding up to SLAB_NR_OBJECTS
+ * objects each, and freed objects are chained in the free list to be reused
+ * before growing the cache with a new slab. Slabs are never returned to the
+ * system.
+ */
+struct kmem_cache {
+	const char *name;
+	size_t size;		/* Size of the object */
+	size_t objsize;		/* @size rounded up to SLAB_ALIGN */
+	unsigned int objs_per_slab;
+
+	void *freelist;		/* Free objects chained through their first word */
+
+	unsigned long nr_slabs;
+	unsigned long nr_objs;		/* Objects in all slabs */
+	unsigned long nr_active;	/* Objects allocated out */
+	unsigned long nr_allocs;
+	unsigned long nr_frees;
+};
+
+#define KMEM_CACHE(__name, __type) \
+	{ .name = __name, .size = sizeof(__type), }
+
+extern struct kmem_cache pte_directory_cache;
+extern struct kmem_cache process_cache;
+extern struct kmem_cache pt_node_cache;
+extern struct kmem_cache hpte_cache;
+
+/**
+ * kmem_cache_alloc(@cache)
+ *
+ * DESCRIPTION
+ *   Allocate a zero-filled object from @cache. The cache is grown with a new
+ *   slab if it has no free object.
+ *
+ * RETURN
+ *   Pointer to the object
+ *   NULL if unable to grow the cache
+ */
+void *kmem_cache_alloc(struct kmem_cache *cache);
+
+/**
+ * kmem_cache_free(@cache, @obj)
+ *
+ * DESCRIPTION
+ *   Return @obj allocated from @cache to the free list of @cache.
+ */
+void kmem_cache_free(struct kmem_cache *cache, void *obj);
+
+#endif
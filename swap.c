@@ -0,0 +1,294 @@
+/**********************************************************************
+ * Copyright (c) 2020-2021
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+
+#include "types.h"
+#include "bitmap.h"
+#include "list_head.h"
+#include "vm.h"
+#include "frame.h"
+#include "swap.h"
+
+unsigned int nr_swap_slots = 0;
+unsigned int nr_free_swap_slots = 0;
+
+unsigned long nr_swap_outs = 0;
+unsigned long nr_swap_ins = 0;
+
+/**
+ * Swap map. @swap_counts is the number of PTEs referring to each slot, and
+ * a bit in @used_slots is set while the slot is taken.
+ */
+static unsigned int *swap_counts = NULL;
+static unsigned long *used_slots = NULL;
+
+/**
+ * File-backed swap area. Swapped-out pages are staged in @batch, and are
+ * written to the swap file with one pwritev() per run of contiguous slots
+ * when the batch is full. Slots are handed out from a cluster cursor so that
+ * consecutive swap-outs land on contiguous slots. Swapped-in pages are read
+ * through the read-only shared mapping of the swap file.
+ */
+#define SWAP_PAGE_SIZE	4096
+#define SWAP_BATCH	32
+
+const char *swap_file = NULL;
+static int swap_fd = -1;
+static unsigned char *swap_map = MAP_FAILED;
+static unsigned int swap_cursor = 0;
+
+struct swap_write {
+	unsigned int slot;
+	unsigned char page[SWAP_PAGE_SIZE];
+};
+static struct swap_write *batch = NULL;
+static unsigned int nr_batched = 0;
+
+unsigned long nr_swap_pages_written = 0;
+unsigned long nr_swap_batches = 0;
+unsigned long nr_swap_pages_read = 0;
+
+static int __init_swap_file(void)
+{
+	size_t size = (size_t)nr_swap_slots * SWAP_PAGE_SIZE;
+
+	swap_fd = open(swap_file, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (swap_fd < 0) {
+		fprintf(stderr, "Unable to open swap file %s\n", swap_file);
+		return -1;
+	}
+	if (ftruncate(swap_fd, size)) {
+		fprintf(stderr, "Unable to size swap file %s\n", swap_file);
+		return -1;
+	}
+
+	swap_map = mmap(NULL, size, PROT_READ, MAP_SHARED, swap_fd, 0);
+	if (swap_map == MAP_FAILED) {
+		fprintf(stderr, "Unable to map swap file %s\n", swap_file);
+		return -1;
+	}
+
+	batch = malloc(sizeof(*batch) * SWAP_BATCH);
+	return batch ? 0 : -1;
+}
+
+static int __compare_swap_write(const void *a, const void *b)
+{
+	const struct swap_write *wa = a;
+	const struct swap_write *wb = b;
+
+	return (wa->slot > wb->slot) - (wa->slot < wb->slot);
+}
+
+/**
+ * Write the batched pages to the swap file, coalescing contiguous slots
+ * into a single pwritev().
+ */
+static void __flush_swap_batch(void)
+{
+	struct iovec iov[SWAP_BATCH];
+	unsigned int start = 0;
+
+	if (!nr_batched) return;
+
+	qsort(batch, nr_batched, sizeof(*batch), __compare_swap_write);
+
+	while (start < nr_batched) {
+		unsigned int end = start + 1;
+		ssize_t ret;
+
+		while (end < nr_batched && batch[end].slot == batch[end - 1].slot + 1) {
+			end++;
+		}
+		for (unsigned int i = start; i < end; i++) {
+			iov[i - start].iov_base = batch[i].page;
+			iov[i - start].iov_len = SWAP_PAGE_SIZE;
+		}
+
+		ret = pwritev(swap_fd, iov, end - start,
+				(off_t)batch[start].slot * SWAP_PAGE_SIZE);
+		if (ret != (ssize_t)(end - start) * SWAP_PAGE_SIZE) {
+			fprintf(stderr, "Unable to write to swap file %s\n", swap_file);
+			exit(EXIT_FAILURE);
+		}
+		start = end;
+	}
+
+	nr_swap_pages_written += nr_batched;
+	nr_swap_batches++;
+	nr_batched = 0;
+}
+
+static struct swap_write *__find_batched(unsigned int slot)
+{
+	for (unsigned int i = 0; i < nr_batched; i++) {
+		if (batch[i].slot == slot) return batch + i;
+	}
+	return NULL;
+}
+
+/**
+ * Generate the page holding the data @content. The page starts with the ID
+ * of the data followed by a pattern derived from it.
+ */
+static void __fill_page(unsigned char *page, unsigned long content)
+{
+	unsigned long *words = (unsigned long *)page;
+
+	for (unsigned int i = 0; i < SWAP_PAGE_SIZE / sizeof(*words); i++) {
+		words[i] = content ^ (i * 0x9e3779b97f4a7c15UL);
+	}
+}
+
+void exit_swap(void)
+{
+	if (swap_fd < 0) return;
+
+	__flush_swap_batch();
+
+	munmap(swap_map, (size_t)nr_swap_slots * SWAP_PAGE_SIZE);
+	close(swap_fd);
+	swap_fd = -1;
+}
+
+int init_swap(void)
+{
+	if (!nr_swap_slots) return 0;
+	if (nr_swap_slots - 1 > PTE_MAX_PFN) {
+		fprintf(stderr, "Swap entries can hold up to %u swap slots\n", PTE_MAX_PFN + 1);
+		return -1;
+	}
+
+	swap_counts = calloc(nr_swap_slots, sizeof(*swap_counts));
+	used_slots = calloc(BITS_TO_LONGS(nr_swap_slots), sizeof(*used_slots));
+	if (!swap_counts || !used_slots) {
+		fprintf(stderr, "Unable to allocate %u swap slots\n", nr_swap_slots);
+		return -1;
+	}
+	nr_free_swap_slots = nr_swap_slots;
+
+	if (swap_file) return __init_swap_file();
+
+	return 0;
+}
+
+unsigned int alloc_swap_slot(void)
+{
+	unsigned int slot = find_next_zero_bit(used_slots, nr_swap_slots, swap_cursor);
+
+	if (slot == nr_swap_slots) {
+		slot = find_first_zero_bit(used_slots, nr_swap_slots);
+	}
+	if (slot == nr_swap_slots) return -1;
+
+	set_bit(slot, used_slots);
+	nr_free_swap_slots--;
+	swap_cursor = slot + 1;
+
+	return slot;
+}
+
+void swap_dup(unsigned int slot)
+{
+	assert(test_bit(slot, used_slots));
+
+	swap_counts[slot]++;
+}
+
+void swap_free(unsigned int slot)
+{
+	assert(swap_counts[slot] > 0);
+
+	if (--swap_counts[slot] == 0) {
+		struct swap_write *w = batch ? __find_batched(slot) : NULL;
+
+		/* No need to write out the page no one refers to */
+		if (w) *w = batch[--nr_batched];
+
+		clear_bit(slot, used_slots);
+		nr_free_swap_slots++;
+	}
+}
+
+unsigned int swap_count(unsigned int slot)
+{
+	return swap_counts[slot];
+}
+
+void swap_out(unsigned int pfn, unsigned int slot)
+{
+	nr_swap_outs++;
+
+	if (swap_fd < 0) return;
+
+	if (nr_batched == SWAP_BATCH) __flush_swap_batch();
+
+	batch[nr_batched].slot = slot;
+	__fill_page(batch[nr_batched].page, frame_contents[pfn]);
+	nr_batched++;
+}
+
+void swap_in(unsigned int slot, unsigned int pfn)
+{
+	struct swap_write *w;
+	const unsigned char *page;
+	unsigned long content;
+
+	nr_swap_ins++;
+
+	if (swap_fd < 0) return;
+
+	/* The page may not be written out yet */
+	w = __find_batched(slot);
+	if (w) {
+		page = w->page;
+	} else {
+		page = swap_map + (size_t)slot * SWAP_PAGE_SIZE;
+		nr_swap_pages_read++;
+	}
+
+	content = *(const unsigned long *)page;
+	assert(((const unsigned long *)page)[SWAP_PAGE_SIZE / sizeof(content) - 1] ==
+			(content ^ ((SWAP_PAGE_SIZE / sizeof(content) - 1) * 0x9e3779b97f4a7c15UL)));
+
+	frame_contents[pfn] = content;
+}
+
+void swap_exchange(unsigned int pfn, unsigned int slot)
+{
+	unsigned long content = frame_contents[pfn];
+	struct swap_write *w;
+
+	swap_in(slot, pfn);
+	nr_swap_outs++;
+
+	if (swap_fd < 0) return;
+
+	/* Overwrite the page if it is not written out yet */
+	w = __find_batched(slot);
+	if (!w) {
+		if (nr_batched == SWAP_BATCH) __flush_swap_batch();
+		w = batch + nr_batched++;
+		w->slot = slot;
+	}
+	__fill_page(w->page, content);
+}
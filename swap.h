@@ -0,0 +1,97 @@
+/**********************************************************************
+ * Copyright (c) 2020-2021
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#ifndef __SWAP_H__
+#define __SWAP_H__
+
+#include "types.h"
+
+/**
+ * The number of slots in the swap area. Page replacement is enabled only if
+ * the system has the swap area (i.e., @nr_swap_slots > 0).
+ */
+extern unsigned int nr_swap_slots;
+extern unsigned int nr_free_swap_slots;
+
+extern unsigned long nr_swap_outs;
+extern unsigned long nr_swap_ins;
+
+/**
+ * Path to the file backing the swap area. If it is NULL, the swap area only
+ * counts swap-ins and swap-outs without doing any I/O.
+ */
+extern const char *swap_file;
+extern unsigned long nr_swap_pages_written;
+extern unsigned long nr_swap_batches;
+extern unsigned long nr_swap_pages_read;
+
+/**
+ * init_swap()
+ *
+ * DESCRIPTION
+ *   Set up the swap area with @nr_swap_slots slots.
+ *
+ * RETURN
+ *   0 on success
+ *   -1 on error
+ */
+int init_swap(void);
+
+/**
+ * exit_swap()
+ *
+ * DESCRIPTION
+ *   Write out the pending pages and close the swap file.
+ */
+void exit_swap(void);
+
+/**
+ * alloc_swap_slot()
+ *
+ * DESCRIPTION
+ *   Take a free swap slot. The slot is released when its last reference,
+ *   which is taken with swap_dup(), is put with swap_free().
+ *
+ * RETURN
+ *   The swap slot
+ *   -1 if the swap area is full
+ */
+unsigned int alloc_swap_slot(void);
+void swap_dup(unsigned int slot);
+void swap_free(unsigned int slot);
+
+/* The number of references to @slot */
+unsigned int swap_count(unsigned int slot);
+
+/**
+ * swap_out(@pfn, @slot)/swap_in(@slot, @pfn)
+ *
+ * DESCRIPTION
+ *   Write the page frame @pfn to @slot, and read @slot into @pfn. With the
+ *   swap file, swap_out() only queues the page to the write batch.
+ */
+void swap_out(unsigned int pfn, unsigned int slot);
+void swap_in(unsigned int slot, unsigned int pfn);
+
+/**
+ * swap_exchange(@pfn, @slot)
+ *
+ * DESCRIPTION
+ *   Swap in @slot to @pfn and swap out @pfn to @slot at once, so that a page
+ *   can be swapped in through its own slot when the swap area is full.
+ */
+void swap_exchange(unsigned int pfn, unsigned int slot);
+
+#endif
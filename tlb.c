@@ -0,0 +1,828 @@
+/**********************************************************************
+ * Copyright (c) 2020-2021
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "types.h"
+#include "list_head.h"
+#include "bitmap.h"
+#include "vm.h"
+#include "tlb.h"
+#include "pgtable.h"
+
+extern struct process *current;
+
+/**
+ * TLBs of the system. @stlb backs @dtlb up as the second level TLB if
+ * @stlb_enabled.
+ */
+struct tlb dtlb = {
+	.latency = 1,
+};
+struct tlb stlb = {
+	.latency = 7,
+};
+bool stlb_enabled = false;
+bool tlb_exclusive = false;
+
+unsigned int walk_latency = 15;
+unsigned long nr_tlb_walks = 0;
+unsigned long nr_walk_refs = 0;
+unsigned long tlb_cycles = 0;
+
+/**
+ * Page-walk cache. A small fully-associative cache of the entries pointing to
+ * page directories, which is replaced in the LRU manner.
+ */
+struct pwc_entry {
+	bool valid;
+	unsigned int asid;
+	unsigned long pd_index;
+	struct pt_entry *pde;
+	unsigned long stamp;
+};
+
+unsigned int nr_pwc_entries = 0;
+static struct pwc_entry *pwc = NULL;
+static unsigned long pwc_clock = 0;
+
+unsigned long nr_pwc_hits = 0;
+unsigned long nr_pwc_misses = 0;
+
+/**
+ * ASID allocator. @current_asid is the ASID of the running process, and
+ * @asid_map tracks the ASIDs assigned in @asid_generation.
+ */
+unsigned int nr_asids = 0;
+static unsigned int current_asid = 0;
+static unsigned long asid_generation = 1;
+static unsigned long asid_map[BITS_TO_LONGS(MAX_NR_ASIDS)];
+
+unsigned long nr_tlb_flushes = 0;
+unsigned long nr_tlb_flushes_avoided = 0;
+unsigned long nr_asid_rollovers = 0;
+
+
+/**
+ * FIFO and LRU. Both evict the way with the smallest stamp; FIFO stamps
+ * a way when it is filled whereas LRU also stamps it on every hit.
+ */
+struct tlb_stamps {
+	unsigned long clock;
+	unsigned long stamps[];
+};
+
+static int __stamps_init(struct tlb *tlb)
+{
+	struct tlb_stamps *s = calloc(1, sizeof(*s) +
+			sizeof(unsigned long) * tlb->nr_sets * tlb->nr_ways);
+
+	if (!s) return -1;
+
+	tlb->policy_data = s;
+	return 0;
+}
+
+static void __stamps_update(struct tlb *tlb, unsigned int set, unsigned int way)
+{
+	struct tlb_stamps *s = tlb->policy_data;
+
+	s->stamps[set * tlb->nr_ways + way] = ++s->clock;
+}
+
+static unsigned int __stamps_victim(struct tlb *tlb, unsigned int set)
+{
+	struct tlb_stamps *s = tlb->policy_data;
+	unsigned long *stamps = s->stamps + set * tlb->nr_ways;
+	unsigned int victim = 0;
+
+	for (unsigned int i = 1; i < tlb->nr_ways; i++) {
+		if (stamps[i] < stamps[victim]) victim = i;
+	}
+	return victim;
+}
+
+static void __fifo_touch(struct tlb *tlb, unsigned int set, unsigned int way)
+{
+}
+
+
+/**
+ * Tree-PLRU. Each set has a binary tree of @nr_ways - 1 bits laid out as
+ * a heap (node 1 is the root). A bit points to the half holding the next
+ * victim, and a hit flips the bits on its path to point away from it.
+ */
+struct tlb_plru {
+	unsigned int nr_levels;
+	unsigned int longs_per_set;
+	unsigned long bits[];
+};
+
+static int __plru_init(struct tlb *tlb)
+{
+	unsigned int longs = BITS_TO_LONGS(tlb->nr_ways);
+	struct tlb_plru *p = calloc(1, sizeof(*p) +
+			sizeof(unsigned long) * longs * tlb->nr_sets);
+
+	if (!p) return -1;
+
+	while ((1U << p->nr_levels) < tlb->nr_ways) p->nr_levels++;
+	p->longs_per_set = longs;
+	tlb->policy_data = p;
+	return 0;
+}
+
+static void __plru_touch(struct tlb *tlb, unsigned int set, unsigned int way)
+{
+	struct tlb_plru *p = tlb->policy_data;
+	unsigned long *bits = p->bits + set * p->longs_per_set;
+	unsigned int node = 1;
+
+	for (int level = p->nr_levels - 1; level >= 0; level--) {
+		unsigned int dir = (way >> level) & 1;
+
+		if (dir) {
+			clear_bit(node, bits);
+		} else {
+			set_bit(node, bits);
+		}
+		node = node * 2 + dir;
+	}
+}
+
+static unsigned int __plru_victim(struct tlb *tlb, unsigned int set)
+{
+	struct tlb_plru *p = tlb->policy_data;
+	unsigned long *bits = p->bits + set * p->longs_per_set;
+	unsigned int node = 1;
+	unsigned int way = 0;
+
+	for (unsigned int level = 0; level < p->nr_levels; level++) {
+		unsigned int dir = test_bit(node, bits);
+
+		way = way * 2 + dir;
+		node = node * 2 + dir;
+	}
+	return way;
+}
+
+
+/**
+ * Random. Each set has its own xorshift state so that the victims of a set
+ * do not depend on the accesses to the other sets.
+ */
+static int __random_init(struct tlb *tlb)
+{
+	unsigned int *seeds = malloc(sizeof(*seeds) * tlb->nr_sets);
+
+	if (!seeds) return -1;
+
+	for (unsigned int i = 0; i < tlb->nr_sets; i++) {
+		seeds[i] = (i + 1) * 2654435761U;
+	}
+	tlb->policy_data = seeds;
+	return 0;
+}
+
+static void __random_touch(struct tlb *tlb, unsigned int set, unsigned int way)
+{
+}
+
+static unsigned int __random_victim(struct tlb *tlb, unsigned int set)
+{
+	unsigned int *seed = (unsigned int *)tlb->policy_data + set;
+	unsigned int x = *seed;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*seed = x;
+
+	return x % tlb->nr_ways;
+}
+
+
+/**
+ * CLOCK. Each way has a reference bit that is set on fill and hit, and each
+ * set has a hand sweeping the ways to give referenced entries a second chance.
+ */
+struct tlb_clock {
+	unsigned int *hands;
+	unsigned char refs[];
+};
+
+static int __clock_init(struct tlb *tlb)
+{
+	struct tlb_clock *c = calloc(1, sizeof(*c) + tlb->nr_sets * tlb->nr_ways);
+
+	if (!c) return -1;
+
+	c->hands = calloc(tlb->nr_sets, sizeof(*c->hands));
+	if (!c->hands) {
+		free(c);
+		return -1;
+	}
+	tlb->policy_data = c;
+	return 0;
+}
+
+static void __clock_touch(struct tlb *tlb, unsigned int set, unsigned int way)
+{
+	struct tlb_clock *c = tlb->policy_data;
+
+	c->refs[set * tlb->nr_ways + way] = 1;
+}
+
+static unsigned int __clock_victim(struct tlb *tlb, unsigned int set)
+{
+	struct tlb_clock *c = tlb->policy_data;
+	unsigned char *refs = c->refs + set * tlb->nr_ways;
+	unsigned int *hand = c->hands + set;
+	unsigned int victim;
+
+	while (refs[*hand]) {
+		refs[*hand] = 0;
+		*hand = (*hand + 1) % tlb->nr_ways;
+	}
+	victim = *hand;
+	*hand = (*hand + 1) % tlb->nr_ways;
+
+	return victim;
+}
+
+
+static const struct tlb_policy tlb_policies[] = {
+	{
+		.name = "fifo",
+		.init = __stamps_init,
+		.touch = __fifo_touch,
+		.fill = __stamps_update,
+		.victim = __stamps_victim,
+	}, {
+		.name = "lru",
+		.init = __stamps_init,
+		.touch = __stamps_update,
+		.fill = __stamps_update,
+		.victim = __stamps_victim,
+	}, {
+		.name = "plru",
+		.init = __plru_init,
+		.touch = __plru_touch,
+		.fill = __plru_touch,
+		.victim = __plru_victim,
+	}, {
+		.name = "random",
+		.init = __random_init,
+		.touch = __random_touch,
+		.fill = __random_touch,
+		.victim = __random_victim,
+	}, {
+		.name = "clock",
+		.init = __clock_init,
+		.touch = __clock_touch,
+		.fill = __clock_touch,
+		.victim = __clock_victim,
+	},
+};
+
+int init_tlb(struct tlb *tlb, unsigned int nr_sets, unsigned int nr_ways,
+		const char *policy)
+{
+	unsigned int nr_entries;
+
+	if (!nr_sets || (nr_sets & (nr_sets - 1)) || !nr_ways) {
+		fprintf(stderr, "TLB needs a power-of-2 number of sets and at least one way\n");
+		return -1;
+	}
+	if ((unsigned long)nr_sets * nr_ways > MAX_TLB_ENTRIES) {
+		fprintf(stderr, "TLB can have up to %u entries\n", MAX_TLB_ENTRIES);
+		return -1;
+	}
+	nr_entries = nr_sets * nr_ways;
+
+	tlb->policy = NULL;
+	for (int i = 0; i < sizeof(tlb_policies) / sizeof(*tlb_policies); i++) {
+		if (strcmp(tlb_policies[i].name, policy) == 0) {
+			tlb->policy = tlb_policies + i;
+			break;
+		}
+	}
+	if (!tlb->policy) {
+		fprintf(stderr, "Unknown TLB replacement policy %s\n", policy);
+		return -1;
+	}
+	if (strcmp(policy, "plru") == 0 && (nr_ways & (nr_ways - 1))) {
+		fprintf(stderr, "Tree-PLRU needs a power-of-2 number of ways\n");
+		return -1;
+	}
+
+	tlb->nr_sets = nr_sets;
+	tlb->nr_ways = nr_ways;
+	tlb->entries = calloc(nr_entries, sizeof(*tlb->entries));
+
+	tlb->hash_shift = 1;
+	while ((1U << tlb->hash_shift) < nr_entries) tlb->hash_shift++;
+	tlb->hash = calloc(1U << tlb->hash_shift, sizeof(*tlb->hash));
+	tlb->used = calloc(BITS_TO_LONGS(nr_entries), sizeof(*tlb->used));
+
+	if (!tlb->entries || !tlb->hash || !tlb->used || tlb->policy->init(tlb)) {
+		fprintf(stderr, "Unable to allocate the TLB of %u entries\n", nr_entries);
+		free(tlb->entries);
+		free(tlb->hash);
+		free(tlb->used);
+		return -1;
+	}
+
+	tlb->nr_hits = tlb->nr_misses = tlb->nr_evictions = 0;
+
+	if (tlb == &stlb) stlb_enabled = true;
+
+	return 0;
+}
+
+
+static inline unsigned int __tlb_hash(struct tlb *tlb, unsigned int asid, unsigned long vpn)
+{
+	unsigned int key = (unsigned int)(vpn ^ (vpn >> 32)) ^ (asid << 16);
+
+	return (key * 2654435761U) >> (32 - tlb->hash_shift);
+}
+
+static struct tlb_entry *__find_tlb(struct tlb *tlb, unsigned int asid,
+		unsigned long vpn, bool huge)
+{
+	struct tlb_entry *t;
+
+	hlist_for_each_entry(t, &tlb->hash[__tlb_hash(tlb, asid, vpn)], hnode) {
+		if (t->vpn == vpn && t->asid == asid && t->huge == huge) return t;
+	}
+	return NULL;
+}
+
+static inline unsigned long __huge_vpn(unsigned long vpn)
+{
+	return vpn & ~(pages_per_huge_page() - 1);
+}
+
+/**
+ * Find the entry translating @vpn, which is either the entry for @vpn or
+ * the entry for the huge page covering @vpn.
+ */
+static struct tlb_entry *__lookup_tlb(struct tlb *tlb, unsigned int asid, unsigned long vpn)
+{
+	struct tlb_entry *t = __find_tlb(tlb, asid, vpn, false);
+
+	if (t) return t;
+
+	return __find_tlb(tlb, asid, __huge_vpn(vpn), true);
+}
+
+static void __invalidate_tlb_entry(struct tlb *tlb, struct tlb_entry *t)
+{
+	hlist_del_init(&t->hnode);
+	clear_bit(t - tlb->entries, tlb->used);
+
+	t->valid = false;
+}
+
+static void __touch_tlb_entry(struct tlb *tlb, struct tlb_entry *t)
+{
+	unsigned int slot = t - tlb->entries;
+
+	tlb->policy->touch(tlb, slot / tlb->nr_ways, slot % tlb->nr_ways);
+}
+
+/**
+ * Put the mapping of @e into @tlb. If an entry has to be evicted for it, the
+ * evicted entry is copied to @evicted and true is returned.
+ */
+static bool __fill_tlb(struct tlb *tlb, const struct tlb_entry *e, struct tlb_entry *evicted)
+{
+	unsigned int set = (e->huge ? e->vpn >> pt_bits : e->vpn) & (tlb->nr_sets - 1);
+	unsigned int first = set * tlb->nr_ways;
+	unsigned int slot;
+	bool eviction = false;
+	struct tlb_entry *t;
+
+	slot = find_next_zero_bit(tlb->used, first + tlb->nr_ways, first);
+	if (slot == first + tlb->nr_ways) {
+		slot = first + tlb->policy->victim(tlb, set);
+		*evicted = tlb->entries[slot];
+		__invalidate_tlb_entry(tlb, tlb->entries + slot);
+		tlb->nr_evictions++;
+		eviction = true;
+	}
+
+	t = tlb->entries + slot;
+	t->valid = true;
+	t->asid = e->asid;
+	t->vpn = e->vpn;
+	t->pfn = e->pfn;
+	t->writable = e->writable;
+	t->huge = e->huge;
+	t->touched = e->touched;
+	hlist_add_head(&t->hnode, &tlb->hash[__tlb_hash(tlb, t->asid, t->vpn)]);
+	set_bit(slot, tlb->used);
+
+	tlb->policy->fill(tlb, set, slot - first);
+
+	return eviction;
+}
+
+/**
+ * Fill the L1 TLB. In the exclusive hierarchy, the L1 victim is moved down
+ * to the L2 TLB instead of being dropped. In the inclusive hierarchy, the
+ * L2 copy of the victim learns the pages translated through the victim.
+ */
+static void __fill_l1_tlb(const struct tlb_entry *e)
+{
+	struct tlb_entry victim;
+
+	if (!__fill_tlb(&dtlb, e, &victim) || !stlb_enabled) return;
+
+	if (tlb_exclusive) {
+		struct tlb_entry dropped;
+		__fill_tlb(&stlb, &victim, &dropped);
+	} else if (victim.huge) {
+		struct tlb_entry *t = __find_tlb(&stlb, victim.asid, victim.vpn, true);
+
+		if (t) t->touched |= victim.touched;
+	}
+}
+
+/* The simulator rejects huge pages larger than @touched can track */
+static inline unsigned long __huge_page_bit(unsigned long vpn)
+{
+	assert(pages_per_huge_page() <= BITS_PER_LONG);
+
+	return 1UL << (vpn & (pages_per_huge_page() - 1));
+}
+
+/**
+ * Account the translation of @vpn through @t. The first translation of each
+ * page through a huge page entry would have missed the TLB with small pages.
+ */
+static void __account_huge_hit(struct tlb_entry *t, unsigned long vpn)
+{
+	if (!t->huge || (t->touched & __huge_page_bit(vpn))) return;
+
+	t->touched |= __huge_page_bit(vpn);
+	current->nr_huge_tlb_saved++;
+}
+
+
+/**
+ * A write through a read-only entry misses like the MMU raising a fault on
+ * it. The entry is dropped so that the page walk refills it with the PTE as
+ * it is after the fault is handled.
+ */
+static bool __tlb_permits(struct tlb *tlb, struct tlb_entry *t, unsigned int rw)
+{
+	if (rw != RW_WRITE || t->writable) return true;
+
+	__invalidate_tlb_entry(tlb, t);
+	return false;
+}
+
+
+/**
+ * lookup_tlb(@vpn, @rw, @pfn)
+ *
+ * DESCRIPTION
+ *   Translate @vpn of the current process for @rw through TLB. If the
+ *   requested VPN exists in the TLB and its entry allows @rw, return true
+ *   with @pfn is set to its PFN. Otherwise, return false. The framework calls
+ *   this function when needed, so do not call this function manually.
+ *
+ *   With the L2 TLB, an L1 miss probes the L2 TLB, and an L2 hit refills
+ *   the L1 TLB. In the exclusive hierarchy, the entry moves from L2 to L1.
+ *
+ * RETURN
+ *   Return true if the translation is cached in the TLB.
+ *   Return false otherwise
+ */
+bool lookup_tlb(unsigned long vpn, unsigned int rw, unsigned int *pfn)
+{
+	struct tlb_entry *t = __lookup_tlb(&dtlb, current_asid, vpn);
+
+	tlb_cycles += dtlb.latency;
+	if (t && !__tlb_permits(&dtlb, t, rw)) t = NULL;
+	if (t) {
+		dtlb.nr_hits++;
+		__touch_tlb_entry(&dtlb, t);
+		__account_huge_hit(t, vpn);
+
+		*pfn = t->pfn + (vpn - t->vpn);
+		return true;
+	}
+	dtlb.nr_misses++;
+
+	if (stlb_enabled) {
+		t = __lookup_tlb(&stlb, current_asid, vpn);
+
+		tlb_cycles += stlb.latency;
+		if (t && !__tlb_permits(&stlb, t, rw)) t = NULL;
+		if (t) {
+			struct tlb_entry hit;
+
+			stlb.nr_hits++;
+			__account_huge_hit(t, vpn);
+			hit = *t;
+			*pfn = t->pfn + (vpn - t->vpn);
+
+			if (tlb_exclusive) {
+				__invalidate_tlb_entry(&stlb, t);
+			} else {
+				__touch_tlb_entry(&stlb, t);
+			}
+			__fill_l1_tlb(&hit);
+			return true;
+		}
+		stlb.nr_misses++;
+	}
+
+	nr_tlb_walks++;
+
+	return false;
+}
+
+
+/**
+ * insert_tlb(@vpn, @pfn, @writable)
+ *
+ * DESCRIPTION
+ *   Insert the mapping from @vpn to @pfn into the TLB. The mapping translates
+ *   writes only if @writable. The entry takes the
+ *   lowest free way of its set. When the set is full, the replacement policy
+ *   picks the entry to evict. The framework will call this function when
+ *   required, so no need to call this function manually.
+ *
+ *   In the inclusive hierarchy, the mapping is put into both levels, and
+ *   an entry evicted from the L2 TLB is also invalidated from the L1 TLB.
+ *   In the exclusive hierarchy, the mapping is put into the L1 TLB only.
+ */
+static void __insert_tlb(struct tlb_entry *e)
+{
+	if (stlb_enabled && !tlb_exclusive) {
+		struct tlb_entry victim;
+
+		if (__fill_tlb(&stlb, e, &victim)) {
+			struct tlb_entry *t = __find_tlb(&dtlb, victim.asid, victim.vpn, victim.huge);
+
+			if (t) __invalidate_tlb_entry(&dtlb, t);
+		}
+	}
+	__fill_l1_tlb(e);
+}
+
+void insert_tlb(unsigned long vpn, unsigned int pfn, bool writable)
+{
+	struct tlb_entry e = {
+		.asid = current_asid, .vpn = vpn, .pfn = pfn, .writable = writable,
+	};
+
+	__insert_tlb(&e);
+}
+
+void insert_huge_tlb(unsigned long vpn, unsigned int pfn, bool writable)
+{
+	struct tlb_entry e = {
+		.asid = current_asid, .vpn = __huge_vpn(vpn), .pfn = pfn,
+		.writable = writable, .huge = true, .touched = __huge_page_bit(vpn),
+	};
+
+	__insert_tlb(&e);
+}
+
+
+static void __invalidate_tlb_level(struct tlb *tlb, unsigned int asid, unsigned long vpn)
+{
+	struct tlb_entry *t = __find_tlb(tlb, asid, vpn, false);
+
+	if (t) __invalidate_tlb_entry(tlb, t);
+
+	t = __find_tlb(tlb, asid, __huge_vpn(vpn), true);
+	if (t) __invalidate_tlb_entry(tlb, t);
+}
+
+static void __invalidate_tlb(unsigned int asid, unsigned long vpn)
+{
+	__invalidate_tlb_level(&dtlb, asid, vpn);
+
+	if (stlb_enabled) __invalidate_tlb_level(&stlb, asid, vpn);
+}
+
+/**
+ * free_tlb(@vpn)
+ *
+ * DESCRIPTION
+ *   Invalidate the TLB entry for @vpn of the current process if exists,
+ *   including the entry for the huge page covering @vpn.
+ */
+void free_tlb(unsigned long vpn)
+{
+	__invalidate_tlb(current_asid, vpn);
+}
+
+void invalidate_tlb(struct process *p, unsigned long vpn)
+{
+	if (p == current) {
+		__invalidate_tlb(current_asid, vpn);
+	} else if (nr_asids && p->asid_generation == asid_generation) {
+		__invalidate_tlb(p->asid, vpn);
+	}
+}
+
+
+static struct pwc_entry *__find_pwc(unsigned long pd_index)
+{
+	for (unsigned int i = 0; i < nr_pwc_entries; i++) {
+		struct pwc_entry *p = pwc + i;
+
+		if (p->valid && p->pd_index == pd_index && p->asid == current_asid) {
+			return p;
+		}
+	}
+	return NULL;
+}
+
+int init_pwc(void)
+{
+	if (!nr_pwc_entries) return 0;
+
+	pwc = calloc(nr_pwc_entries, sizeof(*pwc));
+	if (!pwc) {
+		fprintf(stderr, "Unable to allocate the page-walk cache\n");
+		return -1;
+	}
+	return 0;
+}
+
+struct pt_entry *lookup_pwc(unsigned long pd_index)
+{
+	struct pwc_entry *p;
+
+	if (!pwc) return NULL;
+
+	p = __find_pwc(pd_index);
+	if (!p) {
+		nr_pwc_misses++;
+		return NULL;
+	}
+	nr_pwc_hits++;
+	p->stamp = ++pwc_clock;
+
+	return p->pde;
+}
+
+void insert_pwc(unsigned long pd_index, struct pt_entry *pde)
+{
+	struct pwc_entry *victim;
+
+	if (!pwc) return;
+
+	victim = pwc;
+	for (unsigned int i = 0; i < nr_pwc_entries; i++) {
+		struct pwc_entry *p = pwc + i;
+
+		if (!p->valid) {
+			victim = p;
+			break;
+		}
+		if (p->stamp < victim->stamp) victim = p;
+	}
+
+	victim->valid = true;
+	victim->asid = current_asid;
+	victim->pd_index = pd_index;
+	victim->pde = pde;
+	victim->stamp = ++pwc_clock;
+}
+
+void invalidate_pwc(unsigned long pd_index)
+{
+	struct pwc_entry *p;
+
+	if (!pwc) return;
+
+	p = __find_pwc(pd_index);
+	if (p) p->valid = false;
+}
+
+
+static void __flush_tlb(struct tlb *tlb)
+{
+	unsigned int nr_entries = tlb->nr_sets * tlb->nr_ways;
+
+	for (unsigned int i = find_first_bit(tlb->used, nr_entries); i < nr_entries;
+			i = find_next_bit(tlb->used, nr_entries, i + 1)) {
+		__invalidate_tlb_entry(tlb, tlb->entries + i);
+	}
+}
+
+static void __flush_tlb_asid(struct tlb *tlb, unsigned int asid)
+{
+	unsigned int nr_entries = tlb->nr_sets * tlb->nr_ways;
+
+	for (unsigned int i = find_first_bit(tlb->used, nr_entries); i < nr_entries;
+			i = find_next_bit(tlb->used, nr_entries, i + 1)) {
+		if (tlb->entries[i].asid == asid) __invalidate_tlb_entry(tlb, tlb->entries + i);
+	}
+}
+
+/**
+ * flush_tlb()
+ *
+ * DESCRIPTION
+ *   Invalidate all TLB entries.
+ */
+void flush_tlb(void)
+{
+	__flush_tlb(&dtlb);
+	if (stlb_enabled) __flush_tlb(&stlb);
+
+	if (pwc) {
+		memset(pwc, 0, nr_pwc_entries * sizeof(*pwc));
+	}
+
+	nr_tlb_flushes++;
+}
+
+
+static bool __assign_asid(struct process *p)
+{
+	bool rollover = false;
+	unsigned int asid;
+
+	asid = find_first_zero_bit(asid_map, nr_asids);
+	if (asid == nr_asids) {
+		/* Out of ASIDs. Start over with an empty TLB */
+		asid_generation++;
+		memset(asid_map, 0, BITS_TO_LONGS(nr_asids) * sizeof(*asid_map));
+		flush_tlb();
+		nr_asid_rollovers++;
+
+		asid = 0;
+		rollover = true;
+	}
+	set_bit(asid, asid_map);
+
+	p->asid = asid;
+	p->asid_generation = asid_generation;
+
+	return rollover;
+}
+
+void flush_tlb_of(struct process *p)
+{
+	if (!nr_asids) {
+		flush_tlb();
+		return;
+	}
+
+	/* The entries of the earlier generations are gone with the rollover */
+	if (p->asid_generation != asid_generation) return;
+
+	__flush_tlb_asid(&dtlb, p->asid);
+	if (stlb_enabled) __flush_tlb_asid(&stlb, p->asid);
+
+	for (unsigned int i = 0; pwc && i < nr_pwc_entries; i++) {
+		if (pwc[i].asid == p->asid) pwc[i].valid = false;
+	}
+}
+
+void init_asid(struct process *p)
+{
+	if (!nr_asids) return;
+
+	__assign_asid(p);
+	current_asid = p->asid;
+}
+
+void switch_tlb(struct process *next)
+{
+	if (!nr_asids) {
+		flush_tlb();
+		return;
+	}
+
+	if (next->asid_generation == asid_generation || !__assign_asid(next)) {
+		nr_tlb_flushes_avoided++;
+	}
+	current_asid = next->asid;
+}
@@ -0,0 +1,235 @@
+/**********************************************************************
+ * Copyright (c) 2020-2021
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#ifndef __TLB_H__
+#define __TLB_H__
+
+#include "types.h"
+#include "list_head.h"
+#include "vm.h"
+
+struct tlb;
+
+/**
+ * Replacement policy of a TLB. Each policy keeps its own per-set bookkeeping
+ * in @tlb->policy_data, which is set up by @init. @init returns -1 if unable
+ * to allocate it.
+ *
+ * @touch is called when the entry at (@set, @way) hits, and @fill is called
+ * when a new entry is placed there. @victim picks the way to evict from
+ * a full @set.
+ */
+struct tlb_policy {
+	const char *name;
+	int (*init)(struct tlb *tlb);
+	void (*touch)(struct tlb *tlb, unsigned int set, unsigned int way);
+	void (*fill)(struct tlb *tlb, unsigned int set, unsigned int way);
+	unsigned int (*victim)(struct tlb *tlb, unsigned int set);
+};
+
+/* Upper bound of @nr_sets * @nr_ways, far above the size of any real TLB */
+#define MAX_TLB_ENTRIES	(1 << 20)
+
+/**
+ * Set-associative TLB. @entries holds @nr_sets * @nr_ways entries in the
+ * set-major order, and a VPN is cached in the set (@vpn % @nr_sets). A huge
+ * page takes a single entry in the set of its page directory index.
+ * Valid entries are also chained in @hash so that a lookup does not need to
+ * scan the ways, and @used tracks occupied slots so that a new entry takes
+ * the lowest free way in its set.
+ */
+struct tlb {
+	unsigned int nr_sets;
+	unsigned int nr_ways;
+	struct tlb_entry *entries;
+
+	unsigned int hash_shift;
+	struct hlist_head *hash;
+	unsigned long *used;
+
+	const struct tlb_policy *policy;
+	void *policy_data;
+
+	unsigned int latency;	/* Cycles to probe this TLB */
+
+	unsigned long nr_hits;
+	unsigned long nr_misses;
+	unsigned long nr_evictions;
+};
+
+/**
+ * TLBs of the system. @dtlb is the L1 TLB, and @stlb is the optional L2 TLB
+ * that is probed on L1 misses if @stlb_enabled. In the inclusive hierarchy
+ * (default), L2 holds every translation in L1. In the exclusive hierarchy
+ * (@tlb_exclusive), a translation lives in one level at a time; L1 victims
+ * are moved down to L2, and L2 hits are moved up to L1.
+ */
+extern struct tlb dtlb;
+extern struct tlb stlb;
+extern bool stlb_enabled;
+extern bool tlb_exclusive;
+
+/**
+ * Cost model of the translation. Every probe to a TLB level costs its
+ * @latency cycles, and every memory reference to walk the page table costs
+ * @walk_latency cycles. A walk of the radix page table takes @pt_levels
+ * references, one for each level down to the page directory. If the
+ * page-walk cache holds the entry pointing to the page directory, all the
+ * upper levels are skipped and only the page directory is referenced. A walk
+ * ending at a huge page skips the page directory. A walk of the hashed page
+ * table takes one reference for the hash anchor and one for each entry
+ * probed in its chain.
+ */
+#define MAX_LATENCY	(1 << 16)	/* Cycles, far above a walk to DRAM */
+extern unsigned int walk_latency;
+extern unsigned long nr_tlb_walks;
+extern unsigned long nr_walk_refs;
+extern unsigned long tlb_cycles;
+
+static inline void walk_reference(void)
+{
+	nr_walk_refs++;
+	tlb_cycles += walk_latency;
+}
+
+/* Upper bound of @nr_pwc_entries, which are searched linearly */
+#define MAX_PWC_ENTRIES	4096
+
+/**
+ * Page-walk cache of the entries pointing to page directories, which is
+ * tagged with the ASID and the page directory index (i.e., the VPN without
+ * the PTE index). A hit skips all the upper levels of the page walk.
+ * Disabled if @nr_pwc_entries is 0. It is flushed along with the TLB by
+ * flush_tlb().
+ */
+extern unsigned int nr_pwc_entries;
+extern unsigned long nr_pwc_hits;
+extern unsigned long nr_pwc_misses;
+
+/**
+ * init_pwc()
+ *
+ * DESCRIPTION
+ *   Allocate the @nr_pwc_entries entries of the page-walk cache, if any.
+ *
+ * RETURN
+ *   0 on success
+ *   -1 if unable to allocate the entries
+ */
+int init_pwc(void);
+
+/**
+ * lookup_pwc(@pd_index)
+ *
+ * RETURN
+ *   The entry for page directory @pd_index of the current process
+ *   NULL if not cached
+ */
+struct pt_entry *lookup_pwc(unsigned long pd_index);
+void insert_pwc(unsigned long pd_index, struct pt_entry *pde);
+
+/**
+ * invalidate_pwc(@pd_index)
+ *
+ * DESCRIPTION
+ *   Drop the cached entry for page directory @pd_index of the current
+ *   process. Should be called whenever the page directory is released.
+ */
+void invalidate_pwc(unsigned long pd_index);
+
+/**
+ * Number of address space identifiers, up to MAX_NR_ASIDS as wide as ARM's
+ * 16-bit ASIDs. The TLB is not tagged and is flushed on every context switch
+ * if this is 0.
+ */
+#define MAX_NR_ASIDS	(1 << 16)
+extern unsigned int nr_asids;
+
+extern unsigned long nr_tlb_flushes;
+extern unsigned long nr_tlb_flushes_avoided;
+extern unsigned long nr_asid_rollovers;
+
+/**
+ * init_tlb(@tlb, @nr_sets, @nr_ways, @policy)
+ *
+ * DESCRIPTION
+ *   Set up @tlb with the given geometry and the replacement policy named
+ *   @policy (fifo, lru, plru, random, or clock). Setting up @stlb enables
+ *   the L2 TLB.
+ *
+ * RETURN
+ *   0 on success
+ *   -1 if the geometry or the policy is not supported, or if unable to
+ *   allocate the TLB
+ */
+int init_tlb(struct tlb *tlb, unsigned int nr_sets, unsigned int nr_ways,
+		const char *policy);
+
+/**
+ * init_asid(@p)
+ *
+ * DESCRIPTION
+ *   Assign an ASID to the initial process @p, and make it current.
+ */
+void init_asid(struct process *p);
+
+/**
+ * switch_tlb(@next)
+ *
+ * DESCRIPTION
+ *   Make the TLB translate for the address space of @next. If the TLB is
+ *   tagged with ASIDs, @next keeps its ASID as long as it is assigned in the
+ *   current generation. Otherwise @next gets a free ASID. When ASIDs run out,
+ *   a new generation begins by flushing the entire TLB and recycling all the
+ *   ASIDs. If the TLB is not tagged, the entire TLB is flushed.
+ */
+void switch_tlb(struct process *next);
+
+bool lookup_tlb(unsigned long vpn, unsigned int rw, unsigned int *pfn);
+void insert_tlb(unsigned long vpn, unsigned int pfn, bool writable);
+
+/**
+ * insert_huge_tlb(@vpn, @pfn, @writable)
+ *
+ * DESCRIPTION
+ *   Insert a single entry translating the whole huge page covering @vpn,
+ *   which starts at page frame @pfn. lookup_tlb() translates any VPN in the
+ *   huge page with the entry, and translates writes only if @writable.
+ */
+void insert_huge_tlb(unsigned long vpn, unsigned int pfn, bool writable);
+void free_tlb(unsigned long vpn);
+
+/**
+ * invalidate_tlb(@p, @vpn)
+ *
+ * DESCRIPTION
+ *   Invalidate the TLB entry for @vpn of the process @p, which may not be
+ *   the current process.
+ */
+void invalidate_tlb(struct process *p, unsigned long vpn);
+void flush_tlb(void);
+
+/**
+ * flush_tlb_of(@p)
+ *
+ * DESCRIPTION
+ *   Drop all TLB entries of the process @p at once. If the TLB is tagged
+ *   with ASIDs, only the entries tagged with the ASID of @p are invalidated,
+ *   including those in the page-walk cache, and @p keeps its ASID. If the
+ *   TLB is not tagged, the entire TLB is flushed.
+ */
+void flush_tlb_of(struct process *p);
+
+#endif
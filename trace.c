@@ -0,0 +1,160 @@
+/**********************************************************************
+ * Copyright (c) 2020-2021
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "types.h"
+#include "parser.h"
+#include "trace.h"
+
+int convert_trace(FILE *input, const char *path, trace_record_fn make_record)
+{
+	struct trace_header header = {
+		.magic = TRACE_MAGIC,
+		.version = TRACE_VERSION,
+		.record_size = sizeof(struct trace_record),
+	};
+	char command[MAX_COMMAND_LEN];
+	unsigned long nr_skipped = 0;
+	FILE *output;
+
+	output = fopen(path, "wb");
+	if (!output) {
+		fprintf(stderr, "Unable to open trace file %s\n", path);
+		return -1;
+	}
+
+	/* The header is written again with the number of records at the end */
+	fwrite(&header, sizeof(header), 1, output);
+
+	while (fgets(command, sizeof(command), input)) {
+		const char *pos = command;
+		struct token tokens[MAX_NR_TOKENS];
+		int nr_tokens;
+		struct trace_record record;
+		int ret;
+
+		scan_command(&pos, command + strlen(command), &nr_tokens, tokens);
+		if (nr_tokens == 0) continue;
+
+		ret = make_record(nr_tokens, tokens, &record);
+		if (ret < 0) break;
+
+		if (!ret) {
+			nr_skipped++;
+			continue;
+		}
+		fwrite(&record, sizeof(record), 1, output);
+		header.nr_records++;
+	}
+
+	rewind(output);
+	fwrite(&header, sizeof(header), 1, output);
+
+	if (ferror(output) | fclose(output)) {
+		fprintf(stderr, "Unable to write trace file %s\n", path);
+		return -1;
+	}
+
+	fprintf(stderr, "%" PRIu64 " records written to %s, %lu commands skipped\n",
+			header.nr_records, path, nr_skipped);
+	return 0;
+}
+
+int save_trace(const struct trace *trace, const char *path)
+{
+	struct trace_header header = {
+		.magic = TRACE_MAGIC,
+		.version = TRACE_VERSION,
+		.record_size = sizeof(struct trace_record),
+		.nr_records = trace->nr_records,
+	};
+	FILE *output;
+
+	output = fopen(path, "wb");
+	if (!output) {
+		fprintf(stderr, "Unable to open trace file %s\n", path);
+		return -1;
+	}
+
+	fwrite(&header, sizeof(header), 1, output);
+	fwrite(trace->records, sizeof(struct trace_record), trace->nr_records, output);
+
+	if (ferror(output) | fclose(output)) {
+		fprintf(stderr, "Unable to write trace file %s\n", path);
+		return -1;
+	}
+
+	fprintf(stderr, "%" PRIu64 " records written to %s\n", header.nr_records, path);
+	return 0;
+}
+
+int map_trace(const char *path, struct trace *trace)
+{
+	struct trace_header *header;
+	struct stat st;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) return 1;
+
+	if (fstat(fd, &st) || (size_t)st.st_size < sizeof(*header)) {
+		close(fd);
+		return 1;
+	}
+
+	trace->size = st.st_size;
+	trace->map = mmap(NULL, trace->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (trace->map == MAP_FAILED) {
+		fprintf(stderr, "Unable to map trace file %s\n", path);
+		return -1;
+	}
+
+	header = trace->map;
+	if (memcmp(header->magic, TRACE_MAGIC, sizeof(header->magic))) {
+		munmap(trace->map, trace->size);
+		return 1;
+	}
+
+	if (header->version != TRACE_VERSION ||
+			header->record_size != sizeof(struct trace_record) ||
+			header->nr_records > (trace->size - sizeof(*header)) / sizeof(struct trace_record)) {
+		fprintf(stderr, "Trace file %s is corrupted or of an unknown version\n", path);
+		munmap(trace->map, trace->size);
+		return -1;
+	}
+
+	trace->records = (const struct trace_record *)(header + 1);
+	trace->nr_records = header->nr_records;
+
+	/* The records are replayed once from the beginning to the end */
+	madvise(trace->map, trace->size, MADV_SEQUENTIAL);
+
+	return 0;
+}
+
+void unmap_trace(struct trace *trace)
+{
+	munmap(trace->map, trace->size);
+}
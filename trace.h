@@ -0,0 +1,153 @@
+/**********************************************************************
+ * Copyright (c) 2020-2021
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "types.h"
+
+/**
+ * Binary trace format
+ *
+ * A binary trace is a header followed by fixed-width records in the host
+ * byte order. Each record is a single 64-bit word holding an operation, the
+ * access type, and the argument of the operation, which is the VPN or the
+ * PID to switch to.
+ *
+ *   63                                              8 7    4 3    0
+ *  +-------------------------------------------------+------+------+
+ *  |                  VPN / PID                      |  rw  |  op  |
+ *  +-------------------------------------------------+------+------+
+ *
+ * Only the operations changing the state of the simulation are recorded.
+ * The commands showing the state are dropped on conversion.
+ */
+#define TRACE_MAGIC	"VMTRACE"
+#define TRACE_VERSION	1
+
+enum trace_op {
+	TRACE_ALLOC = 1,
+	TRACE_HALLOC,
+	TRACE_FREE,
+	TRACE_ACCESS,
+	TRACE_SWITCH,
+};
+
+struct trace_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t record_size;
+	uint64_t nr_records;
+};
+
+struct trace_record {
+	uint64_t val;
+};
+
+#define TRACE_OP_MASK	0x0f
+#define TRACE_RW_SHIFT	4
+#define TRACE_RW_MASK	0x0f
+#define TRACE_ARG_SHIFT	8
+
+static inline struct trace_record make_trace_record(unsigned int op, unsigned int rw, unsigned long arg)
+{
+	struct trace_record r = {
+		.val = ((uint64_t)arg << TRACE_ARG_SHIFT) |
+			((rw & TRACE_RW_MASK) << TRACE_RW_SHIFT) | (op & TRACE_OP_MASK),
+	};
+	return r;
+}
+
+static inline unsigned int trace_op(const struct trace_record *r)
+{
+	return r->val & TRACE_OP_MASK;
+}
+
+static inline unsigned int trace_rw(const struct trace_record *r)
+{
+	return (r->val >> TRACE_RW_SHIFT) & TRACE_RW_MASK;
+}
+
+static inline unsigned long trace_arg(const struct trace_record *r)
+{
+	return r->val >> TRACE_ARG_SHIFT;
+}
+
+/**
+ * A binary trace mapped into the memory
+ */
+struct trace {
+	void *map;
+	size_t size;
+	const struct trace_record *records;
+	size_t nr_records;
+};
+
+struct token;
+
+/**
+ * Translate the command in @tokens into @record. Return 1 if translated,
+ * 0 if the command is not recorded in the binary trace, and -1 if the
+ * command ends the simulation.
+ */
+typedef int (*trace_record_fn)(int nr_tokens, const struct token *tokens,
+		struct trace_record *record);
+
+/**
+ * convert_trace(@input, @path, @make_record)
+ *
+ * DESCRIPTION
+ *   Convert the text workload from @input into the binary trace at @path,
+ *   translating each command with @make_record. The conversion stops at the
+ *   command ending the simulation as the simulation does.
+ *
+ * RETURN
+ *   0 on success
+ *   -1 on error
+ */
+int convert_trace(FILE *input, const char *path, trace_record_fn make_record);
+
+/**
+ * save_trace(@trace, @path)
+ *
+ * DESCRIPTION
+ *   Write the records of @trace, such as a generated workload, to @path as
+ *   a binary trace.
+ *
+ * RETURN
+ *   0 on success
+ *   -1 on error
+ */
+int save_trace(const struct trace *trace, const char *path);
+
+/**
+ * map_trace(@path, @trace)
+ *
+ * DESCRIPTION
+ *   Map the binary trace at @path read-only to @trace.
+ *
+ * RETURN
+ *   0 if mapped
+ *   1 if @path is not a binary trace
+ *   -1 on error
+ */
+int map_trace(const char *path, struct trace *trace);
+void unmap_trace(struct trace *trace);
+
+#endif
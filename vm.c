@@ -21,17 +21,68 @@
 #include <ctype.h>
 #include <inttypes.h>
 #include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "types.h"
 #include "parser.h"
 
 #include "list_head.h"
+#include "bitmap.h"
 #include "vm.h"
+#include "tlb.h"
+#include "frame.h"
+#include "swap.h"
+#include "slab.h"
+#include "pgtable.h"
+#include "trace.h"
+#include "gen.h"
 
 static bool verbose = true;
 
 static bool print_tlb_result = false;
 
+/**
+ * In the batch mode, the result of each operation is not printed, and the
+ * aggregates are printed at the end of the simulation instead
+ */
+static bool batch = false;
+static unsigned long nr_reads = 0;
+static unsigned long nr_writes = 0;
+static unsigned long nr_failed_accesses = 0;
+static unsigned long nr_allocs = 0;
+static unsigned long nr_frees = 0;
+
+/* The number of page table walks by the MMU on TLB misses */
+static unsigned long nr_page_walks = 0;
+
+/**
+ * Page faults raised by the MMU by the cause; accesses to VPNs without the
+ * page directory, accesses through invalid PTEs, and writes to
+ * write-protected PTEs. A write to a copy-on-write page may copy the page
+ * or reuse it in place.
+ */
+static unsigned long nr_pd_faults = 0;
+static unsigned long nr_pte_faults = 0;
+static unsigned long nr_wp_faults = 0;
+
+/* Dump the statistics in JSON to this file at exit. "-" is for stdout */
+static const char *stats_json_path = NULL;
+
+/* Size of the block buffering stderr in KiB. Zero leaves stderr unbuffered */
+static unsigned int output_block_kb = 0;
+
+/**
+ * TLB geometry and replacement policy
+ */
+static unsigned int tlb_sets = 1;
+static unsigned int tlb_ways = NR_TLB_ENTRIES;
+static const char *tlb_policy = "fifo";
+
+static unsigned int stlb_sets = 1;
+static unsigned int stlb_ways = 0;
+static const char *stlb_policy = "lru";
+
 /**
  * Initial process
  */
@@ -39,7 +90,7 @@ static struct process init = {
 	.pid = 0,
 	.list = LIST_HEAD_INIT(init.list),
 	.pagetable = {
-		.outer_ptes = { NULL },
+		.root = NULL,
 	},
 };
 
@@ -59,25 +110,102 @@ LIST_HEAD(processes);
  */
 struct pagetable *ptbr = NULL;
 
+extern unsigned int alloc_page(unsigned long vpn, unsigned int rw);
+extern unsigned int alloc_huge_page(unsigned long vpn, unsigned int rw);
+extern void free_page(unsigned long vpn);
+extern bool handle_page_fault(unsigned long vpn, unsigned int rw);
+extern void switch_process(unsigned int pid);
+
+extern unsigned long nr_major_faults;
+extern unsigned long nr_minor_faults;
+extern unsigned long nr_cow_copies;
+extern unsigned long nr_switches;
+extern bool lazy_fork;
+extern unsigned long nr_forks;
+extern bool auto_compact;
+extern unsigned long nr_compactions;
+extern unsigned long nr_compact_moved;
+extern unsigned long nr_compact_scanned;
+extern unsigned long nr_compact_ptes;
+extern void compact_memory(int order);
+extern unsigned long nr_fork_pt_visits;
+extern unsigned int thp_threshold;
+extern unsigned long nr_thp_scanned;
+extern unsigned int collapse_huge_pages(void);
+
+/* Scan for transparent huge pages every @thp_scan_interval commands */
+static unsigned int thp_scan_interval = 0;
+
 /**
- * Map count for each page frame
+ * __walk_radix(@pt, @vpn, @pdep)
+ *
+ * DESCRIPTION
+ *   Walk the radix page table @pt for @vpn level by level. The upper levels
+ *   are skipped if the page-walk cache has the entry for @vpn. @pdep is set
+ *   to the entry pointing to the page directory. If the entry maps a huge
+ *   page, the walk ends there without referencing the page directory.
+ *
+ * RETURN
+ *   The PTE for @vpn, or the PTE of the huge page covering @vpn
+ *   NULL if the page directory does not exist
  */
-unsigned int mapcounts[NR_PAGEFRAMES] = { 0 };
+static struct pte *__walk_radix(struct pagetable *pt, unsigned long vpn, struct pt_entry **pdep)
+{
+	struct pt_entry *pde;
+
+	/* Walk the upper levels unless the page-walk cache has the entry */
+	pde = lookup_pwc(pd_index(vpn));
+	if (!pde) {
+		struct pt_node *node = pt->root;
+
+		for (unsigned int level = 0; level < pt_levels - 1; level++) {
+			walk_reference();
+
+			/* Page table node does not exist */
+			if (!node) return NULL;
+
+			pde = &node->entries[pt_index(vpn, level)];
+			node = pde->next;
+		}
+
+		/* Page directory does not exist */
+		if (!pde->next && !pde->huge) return NULL;
+
+		insert_pwc(pd_index(vpn), pde);
+	}
+	*pdep = pde;
+
+	if (pde->huge) return &pde->pte;
+
+	walk_reference();
+
+	return pd_pte(pde, vpn);
+}
 
 /**
- * TLB of the system
+ * __walk_hashed(@pt, @vpn)
+ *
+ * DESCRIPTION
+ *   Probe the hash anchor for @vpn, and the entries chained from it until
+ *   the entry for @vpn of @pt is found.
+ *
+ * RETURN
+ *   The PTE for @vpn
+ *   NULL if the PTE does not exist
  */
-struct tlb_entry tlb[NR_TLB_ENTRIES] = {
-	{false, 0, 0},
-};
+static struct pte *__walk_hashed(struct pagetable *pt, unsigned long vpn)
+{
+	unsigned int id = pagetable_id(pt);
 
-extern unsigned int alloc_page(unsigned int vpn, unsigned int rw);
-extern void free_page(unsigned int vpn);
-extern bool handle_page_fault(unsigned int vpn, unsigned int rw);
-extern void switch_process(unsigned int pid);
+	walk_reference();
 
-extern bool lookup_tlb(unsigned int vpn, unsigned int *pfn);
-extern void insert_tlb(unsigned int vpn, unsigned int pfn);
+	for (struct hpte *h = hpt_anchors[hpt_hash(id, vpn)]; h; h = h->next) {
+		walk_reference();
+
+		if (h->id == id && h->vpn == vpn) return &h->pte;
+	}
+	return NULL;
+}
 
 /**
  * __translate()
@@ -91,17 +219,15 @@ extern void insert_tlb(unsigned int vpn, unsigned int pfn);
  *   @false if unable to translate. This includes the case when the page access
  *   is for write (indicated in @rw), but the @writable of the pte is @false.
  */
-static bool __translate(unsigned int rw, unsigned int vpn, unsigned int *pfn, bool *from_tlb)
+static bool __translate(unsigned int rw, unsigned long vpn, unsigned int *pfn, bool *from_tlb)
 {
-	int pd_index = vpn / NR_PTES_PER_PAGE;
-	int pte_index = vpn % NR_PTES_PER_PAGE;
-
 	struct pagetable *pt = ptbr;
-	struct pte_directory *pd;
+	struct pt_entry *pde = NULL;
 	struct pte *pte;
+	bool writable;
 
 	/* Lookup the mapping from TLB */
-	if (print_tlb_result && lookup_tlb(vpn, pfn)) {
+	if (print_tlb_result && lookup_tlb(vpn, rw, pfn)) {
 		*from_tlb = true;
 		return true;
 	}
@@ -112,30 +238,86 @@ static bool __translate(unsigned int rw, unsigned int vpn, unsigned int *pfn, bo
 	/* Page table is invalid */
 	if (!pt) return false;
 
-	pd = pt->outer_ptes[pd_index];
+	nr_page_walks++;
 
-	/* Page directory does not exist */
-	if (!pd) return false;
-
-	pte = &pd->ptes[pte_index];
+	if (pt_format == PT_HASHED) {
+		pte = __walk_hashed(pt, vpn);
+	} else {
+		pte = __walk_radix(pt, vpn, &pde);
+	}
 
 	/* PTE is invalid */
-	if (!pte->valid) return false;
+	if (!pte || !pte_valid(pte)) return false;
 
 	/* Unable to handle the write access */
+	writable = pte_writable(pte) && !(pde && pde->shared);
 	if (rw == RW_WRITE) {
-		if (!pte->writable) return false;
+		if (!writable) return false;
+		pte_set_flags(pte, PTE_DIRTY);
 	}
-	*pfn = pte->pfn;
+	*pfn = pte_pfn(pte);
+
+	/* The huge page maps the frames in the same order as the pages */
+	if (pte_huge(pte)) *pfn += vpn & (pages_per_huge_page() - 1);
+
+	pte_set_flags(pte, PTE_ACCESSED);
 
 	/* Insert the mapping into TLB */
 	if (print_tlb_result) {
-		insert_tlb(vpn, *pfn);
+		if (pte_huge(pte)) {
+			insert_huge_tlb(vpn, pte_pfn(pte), writable);
+		} else {
+			insert_tlb(vpn, *pfn, writable);
+		}
 	}
 
 	return true;
 }
 
+/**
+ * __count_fault(@vpn, @rw)
+ *
+ * DESCRIPTION
+ *   Account the page fault raised for accessing @vpn for @rw by its cause,
+ *   as __translate() sees it. The page directory shared by the lazy fork is
+ *   write-protected as a whole.
+ */
+static void __count_fault(unsigned long vpn, unsigned int rw)
+{
+	struct pte *pte = lookup_pte(&current->pagetable, vpn);
+	struct pt_entry *pde;
+
+	if (!pte) {
+		nr_pd_faults++;
+	} else if (!pte_valid(pte)) {
+		nr_pte_faults++;
+	} else if (rw == RW_WRITE) {
+		pde = pt_format == PT_HASHED ? NULL : lookup_pd(&current->pagetable, vpn);
+
+		if (!pte_writable(pte) || (pde && pde->shared)) nr_wp_faults++;
+	}
+}
+
+/**
+ * __vpn_in_range(@vpn)
+ *
+ * DESCRIPTION
+ *   We have pt_levels levels of page table nodes indexed by pt_bits bits
+ *   each. Thus each process can have up to 2^(pt_levels * pt_bits) as its
+ *   VPN. Larger VPNs from the workload would alias the lower ones.
+ *
+ * RETURN
+ *   @true if @vpn is in the address space
+ *   @false otherwise, after printing the error
+ */
+static bool __vpn_in_range(unsigned long vpn)
+{
+	if (vpn < (1UL << nr_vpn_bits())) return true;
+
+	fprintf(stderr, "%lu is out of the address space\n", vpn);
+	return false;
+}
+
 /**
  * __access_memory
  *
@@ -147,7 +329,7 @@ static bool __translate(unsigned int rw, unsigned int vpn, unsigned int *pfn, bo
  *   @true on successful access
  *   @false if unable to access @vpn for @rw
  */
-static bool __access_memory(unsigned int vpn, unsigned int rw)
+static bool __access_memory(unsigned long vpn, unsigned int rw)
 {
 	unsigned int pfn;
 	int ret;
@@ -156,22 +338,28 @@ static bool __access_memory(unsigned int vpn, unsigned int rw)
 	/* Cannot read and write at the same time!! */
 	assert((rw & RW_READ) ^ (rw & RW_WRITE));
 
-	/**
-	 * We have NR_PTES_PER_PAGE entries in the outer table and so do for
-	 * inner page table. Thus each process can have up to NR_PTES_PER_PAGE^2
-	 * as its VPN
-	 */
-	assert(vpn < NR_PTES_PER_PAGE * NR_PTES_PER_PAGE);
+	if (rw == RW_READ) {
+		nr_reads++;
+	} else {
+		nr_writes++;
+	}
+
+	if (!__vpn_in_range(vpn)) {
+		nr_failed_accesses++;
+		return false;
+	}
 
 	do {
 		bool from_tlb;
 		/* Ask MMU to translate VPN */
 		if (__translate(rw, vpn, &pfn, &from_tlb)) {
 			/* Success on address translation */
+			if (batch) return true;
+
 			if (print_tlb_result) {
 				fprintf(stderr, "%c |", from_tlb ? 'o' : 'x');
 			}
-			fprintf(stderr, " %3u --> %-3u\n", vpn, pfn);
+			fprintf(stderr, " %3lu --> %-3u\n", vpn, pfn);
 			return true;
 		}
 
@@ -180,41 +368,84 @@ static bool __access_memory(unsigned int vpn, unsigned int rw)
 		 * and restart the translation if the fault is successfully handled.
 		 * Count the number of retries to prevent buggy translation.
 		 */
+		__count_fault(vpn, rw);
 		nr_retries++;
 	} while ((ret = handle_page_fault(vpn, rw)) == true && nr_retries < 2);
 
 	if (ret == false) {
-		fprintf(stderr, "Unable to access %u\n", vpn);
+		nr_failed_accesses++;
+		if (!batch) fprintf(stderr, "Unable to access %lu\n", vpn);
 	}
 
 	return ret;
 }
 
-static unsigned int __make_rwflag(const char *rw)
+/**
+ * __lookup_page(@vpn)
+ *
+ * DESCRIPTION
+ *   Look up the PTE mapping @vpn of the current process, which may be
+ *   swapped out, as the OS does. Unlike __translate(), this neither faults
+ *   the page in nor goes through the TLB and the page-walk cache.
+ *
+ * RETURN
+ *   The PTE for @vpn if the page is allocated
+ *   NULL otherwise
+ */
+static struct pte *__lookup_page(unsigned long vpn)
+{
+	struct pte *pte = lookup_pte(&current->pagetable, vpn);
+
+	if (!pte || !(pte_valid(pte) || pte_swapped(pte))) return NULL;
+
+	return pte;
+}
+
+static void __print_page(struct pte *pte, unsigned long vpn)
 {
-	int len = strlen(rw);
-	unsigned int rwflag = 0;
+	unsigned int pfn = pte_pfn(pte);
 
-	for (int i = 0; i < len; i++) {
-		if (rw[i] == 'r' || rw[i] == 'R') {
-			rwflag |= RW_READ;
-		}
-		if (rw[i] == 'w' || rw[i] == 'W') {
-			rwflag |= RW_WRITE;
-		}
+	if (pte_swapped(pte)) {
+		fprintf(stderr, "swap slot %u", pfn);
+		return;
 	}
-	return rwflag;
+	if (pte_huge(pte)) pfn += vpn & (pages_per_huge_page() - 1);
+
+	fprintf(stderr, "%u", pfn);
+}
+
+/**
+ * Promoting a page directory to a transparent huge page below the full
+ * population fills the pages not allocated yet. Allocating one of them later
+ * takes the page already there if the huge page is mapped for @rw.
+ */
+static bool __filled_by_thp(struct pte *pte, unsigned int rw)
+{
+	if (!pte_thp(pte)) return false;
+
+	return !!(rw & RW_WRITE) == (pte_writable(pte) || pte_cow(pte));
 }
 
-static bool __alloc_page(unsigned int vpn, unsigned int rw)
+static bool __alloc_page(unsigned long vpn, unsigned int rw)
 {
 	unsigned int pfn;
-	bool from_tlb;
+	struct pte *pte;
 
 	assert(rw);
 
-	if (__translate(RW_READ, vpn, &pfn, &from_tlb)) {
-		fprintf(stderr, "%u is already allocated to %u\n", vpn, pfn);
+	if (!__vpn_in_range(vpn)) return false;
+
+	pte = __lookup_page(vpn);
+	if (pte && __filled_by_thp(pte, rw)) {
+		pfn = pte_pfn(pte) + (vpn & (pages_per_huge_page() - 1));
+		nr_allocs++;
+		if (!batch) fprintf(stderr, "alloc %3lu --> %-3u\n", vpn, pfn);
+		return true;
+	}
+	if (pte) {
+		fprintf(stderr, "%lu is already allocated to ", vpn);
+		__print_page(pte, vpn);
+		fprintf(stderr, "\n");
 		return false;
 	}
 
@@ -223,226 +454,1373 @@ static bool __alloc_page(unsigned int vpn, unsigned int rw)
 		fprintf(stderr, "memory is full\n");
 		return false;
 	}
-	fprintf(stderr, "alloc %3u --> %-3u\n", vpn, pfn);
+	nr_allocs++;
+	if (!batch) fprintf(stderr, "alloc %3lu --> %-3u\n", vpn, pfn);
 	
 	return true;
 }
 
-static bool __free_page(unsigned int vpn)
+/**
+ * A TLB entry for a huge page tracks the pages translated through it in a
+ * word, so the TLB cannot take larger huge pages
+ */
+static bool __huge_tlb_supported(void)
+{
+	if (!print_tlb_result || pages_per_huge_page() <= BITS_PER_LONG) return true;
+
+	fprintf(stderr, "Huge pages through the TLB should be up to %zu pages\n",
+			BITS_PER_LONG);
+	return false;
+}
+
+static void __alloc_huge_page(unsigned long vpn, unsigned int rw)
 {
+	unsigned long nr_pages = pages_per_huge_page();
 	unsigned int pfn;
-	bool from_tlb;
 
-	if (!__translate(RW_READ, vpn, &pfn, &from_tlb)) {
-		fprintf(stderr, "%u is not allocated\n", vpn);
+	assert(rw);
+
+	if (pt_format != PT_RADIX) {
+		fprintf(stderr, "Huge pages need the radix page table\n");
+		return;
+	}
+	if (!__huge_tlb_supported() || !__vpn_in_range(vpn)) return;
+	if (vpn & (nr_pages - 1)) {
+		fprintf(stderr, "%lu is not aligned to %lu pages\n", vpn, nr_pages);
+		return;
+	}
+	if (lookup_pte(&current->pagetable, vpn)) {
+		fprintf(stderr, "%lu-%lu is already in use\n", vpn, vpn + nr_pages - 1);
+		return;
+	}
+
+	pfn = alloc_huge_page(vpn, rw);
+	if (pfn == -1) {
+		fprintf(stderr, "no %lu contiguous page frames\n", nr_pages);
+		return;
+	}
+	nr_allocs++;
+	if (!batch) fprintf(stderr, "alloc %3lu --> %-3u (%lu pages)\n", vpn, pfn, nr_pages);
+}
+
+static bool __free_page(unsigned long vpn)
+{
+	struct pte *pte;
+
+	if (!__vpn_in_range(vpn)) return false;
+
+	/* A swapped-out page is freed along with its swap slot */
+	pte = __lookup_page(vpn);
+	if (!pte) {
+		fprintf(stderr, "%lu is not allocated\n", vpn);
 		return false;
 	}
-	fprintf(stderr, "free %u (pfn %u)\n", vpn, pfn);
+	nr_frees++;
+	if (!batch) {
+		fprintf(stderr, "free %lu (%s", vpn, pte_swapped(pte) ? "" : "pfn ");
+		__print_page(pte, vpn);
+		fprintf(stderr, ")\n");
+	}
 	free_page(vpn);
 
 	return true;
 }
 
+/* Switching to a new process fails if unable to fork it */
+static void __switch_process(unsigned int pid)
+{
+	switch_process(pid);
+
+	if (current->pid != pid) fprintf(stderr, "Unable to fork %u\n", pid);
+}
+
 static void __init_system(void)
 {
 	ptbr = &init.pagetable;
+
+	init_asid(current);
 }
 
-static void __show_pageframes(void)
+static void __show_pageframes(unsigned int from, unsigned int to)
 {
-	for (unsigned int i = 0; i < NR_PAGEFRAMES; i++) {
-		if (!mapcounts[i]) continue;
+	if (to > nr_pageframes) to = nr_pageframes;
+
+	for (unsigned int i = next_mapped_frame(from); i < to;
+			i = next_mapped_frame(i + 1)) {
 		fprintf(stderr, "%3u: %d\n", i, mapcounts[i]);
 	}
 	fprintf(stderr, "\n");
 }
 
-static void __show_pagetable(void)
+static void __show_pageframes_summary(void)
 {
-	fprintf(stderr, "\n*** PID %u ***\n", current->pid);
+	unsigned int nr_shared = 0;
+	unsigned int max_mapcount = 0;
+
+	for (unsigned int i = next_mapped_frame(0); i < nr_pageframes;
+			i = next_mapped_frame(i + 1)) {
+		if (mapcounts[i] > 1) nr_shared++;
+		if (mapcounts[i] > max_mapcount) max_mapcount = mapcounts[i];
+	}
 
-	for (int i = 0; i < NR_PTES_PER_PAGE; i++) {
-		struct pte_directory *pd = current->pagetable.outer_ptes[i];
+	fprintf(stderr, "%u frames, %u in use, %u free, %u shared, max mapcount %u\n",
+			nr_pageframes, nr_pageframes - nr_free_frames, nr_free_frames,
+			nr_shared, max_mapcount);
+}
 
-		if (!pd) continue;
+static void __show_pte(struct pte *pte, unsigned long vpn, bool shared)
+{
+	int width = snprintf(NULL, 0, "%lu", (1UL << pt_bits) - 1);
 
-		for (int j = 0; j < NR_PTES_PER_PAGE; j++) {
-			struct pte *pte = &pd->ptes[j];
+	if (width < 2) width = 2;
 
-			if (!verbose && !pte->valid) continue;
-			fprintf(stderr, "%02d:%02d %c%c | %-3d\n", i, j,
-				pte->valid ? 'v' : ' ',
-				pte->writable ? 'w' : ' ',
-				pte->pfn);
-		}
-		printf("\n");
+	for (unsigned int level = 0; level < pt_levels; level++) {
+		fprintf(stderr, level ? ":%0*u" : "%0*u", width, pt_index(vpn, level));
 	}
+
+	/* A huge page shows the range of the PTE index and the page frames */
+	if (pte_huge(pte)) {
+		fprintf(stderr, "-%0*lu %c%c | %u-%u\n", width, pages_per_huge_page() - 1,
+			'v', pte_writable(pte) ? 'w' : ' ',
+			pte_pfn(pte), pte_pfn(pte) + (unsigned int)pages_per_huge_page() - 1);
+		return;
+	}
+
+	fprintf(stderr, " %c%c | %-3u\n",
+		pte_valid(pte) ? 'v' : (pte_swapped(pte) ? 's' : ' '),
+		pte_writable(pte) && !shared ? 'w' : ' ',
+		pte_pfn(pte));
 }
 
-static void __show_tlb(void)
+static void __show_pd(struct pt_entry *pde, unsigned long vpn, void *data)
 {
-	for (int i = 0; i < sizeof(tlb) / sizeof(*tlb); i++) {
-		struct tlb_entry *t = tlb + i;
+	if (pde->huge) {
+		__show_pte(&pde->pte, vpn, false);
+		printf("\n");
+		return;
+	}
 
-		if (!t->valid) continue;
+	for (unsigned long i = 0; i < (1UL << pt_bits); i++) {
+		struct pte *pte = pd_pte(pde, vpn + i);
 
-		fprintf(stderr, "%3d -> %-3d\n", t->vpn, t->pfn);
+		if (!verbose && pte_none(pte)) continue;
+
+		__show_pte(pte, vpn + i, pde->shared);
 	}
+	printf("\n");
 }
 
-static void __print_help(void)
+static void __show_hpte(struct pte *pte, unsigned long vpn, void *data)
 {
-	printf("  help | ?     : Print out this help message \n");
-	printf("  exit         : Exit the simulation\n");
-	printf("\n");
-	printf("  switch [pid] : Do context switch to pid @pid\n");
-	printf("                 Fork @pid if there is no process with the pid\n");
-	printf("  show         : Show the page table of the current process\n");
-	printf("  pages        : Show the status for each page frame\n");
-	printf("  tlb          : Show TLB entries\n");
-	printf("\n");
-	printf("  alloc [vpn] r|w  : Allocate a page for the rw flag\n");
-	printf("  free [vpn]       : Deallocate the page at VPN @vpn\n");
-	printf("  access [vpn] r|w : Access VPN @vpn for read or write\n");
-	printf("  read [vpn]       : Equivalent to access @vpn r\n");
-	printf("  write [vpn]      : Equivalent to access @vpn w\n");
-	printf("\n");
+	__show_pte(pte, vpn, false);
 }
 
-static bool strmatch(char * const str, const char *expect)
+static void __show_pagetable(void)
 {
-	return (strlen(str) == strlen(expect)) &&
-			(strncmp(str, expect, strlen(expect)) == 0);
+	fprintf(stderr, "\n*** PID %u ***\n", current->pid);
+
+	if (pt_format == PT_HASHED) {
+		for_each_pte(&current->pagetable, __show_hpte, NULL);
+	} else {
+		for_each_pd(&current->pagetable, __show_pd, NULL);
+	}
 }
 
-static void __do_simulation(FILE *input)
+static void __show_tlb(void)
 {
-	char command[MAX_COMMAND_LEN] = { 0 };
+	struct tlb *levels[] = { &dtlb, &stlb };
 
-	__init_system();
+	for (int l = 0; l < (stlb_enabled ? 2 : 1); l++) {
+		struct tlb *tlb = levels[l];
 
-	while (fgets(command, sizeof(command), input)) {
-		char *tokens[MAX_NR_TOKENS] = { NULL };
-		int nr_tokens = 0;
+		if (stlb_enabled) fprintf(stderr, "L%d:\n", l + 1);
 
-		/* Make the command lowercase */
-		for (size_t i = 0; i < strlen(command); i++) {
-			command[i] = tolower(command[i]);
-		}
+		for (int i = 0; i < tlb->nr_sets * tlb->nr_ways; i++) {
+			struct tlb_entry *t = tlb->entries + i;
 
-		if (parse_command(command, &nr_tokens, tokens) < 0) {
-			continue;
-		}
-		if (nr_tokens == 0) continue;
+			if (!t->valid) continue;
 
-		if (nr_tokens == 1) {
-			if (strmatch(tokens[0], "exit")) break;
-			if (strmatch(tokens[0], "show")) {
-				__show_pagetable();
-			} else if (strmatch(tokens[0], "pages")) {
-				__show_pageframes();
-			} else if (strmatch(tokens[0], "tlb")) {
-				__show_tlb();
-			} else if (strmatch(tokens[0], "help") || strmatch(tokens[0], "?")) {
-				__print_help();
-			} else {
-				printf("Unknown command %s\n", tokens[0]);
-			}
-		} else if (nr_tokens == 2) {
-			unsigned int arg = strtoimax(tokens[1], NULL, 0);
-
-			if (strmatch(tokens[0], "switch") || strmatch(tokens[0], "s")) {
-				switch_process(arg);
-			} else if (strmatch(tokens[0], "free") || strmatch(tokens[0], "f")) {
-				__free_page(arg);
-			} else if (strmatch(tokens[0], "read") || strmatch(tokens[0], "r")) {
-				__access_memory(arg, RW_READ);
-			} else if (strmatch(tokens[0], "write") || strmatch(tokens[0], "w")) {
-				__access_memory(arg, RW_WRITE);
-			} else {
-				printf("Unknown command %s\n", tokens[0]);
-			}
-		} else if (nr_tokens == 3) {
-			unsigned int vpn = strtoimax(tokens[1], NULL, 0);
-			unsigned int rw = __make_rwflag(tokens[2]);
-
-			if (strmatch(tokens[0], "alloc") || strmatch(tokens[0], "a")) {
-				if (!__alloc_page(vpn, rw)) break;
-			} else if (strmatch(tokens[0], "access")) {
-				__access_memory(vpn, rw);
+			if (nr_asids) fprintf(stderr, "%3u: ", t->asid);
+
+			if (t->huge) {
+				fprintf(stderr, "%3lu -> %-3u (%lu pages)\n", t->vpn, t->pfn,
+						pages_per_huge_page());
 			} else {
-				printf("Unknown command %s\n", tokens[0]);
+				fprintf(stderr, "%3lu -> %-3u\n", t->vpn, t->pfn);
 			}
-		} else {
-			assert(!"Unknown command in trace");
 		}
+	}
 
-		if (verbose) printf(">> ");
+	if (stlb_enabled) {
+		fprintf(stderr, "L1 %lu hits, L2 %lu hits, %lu walks, %lu cycles\n",
+				dtlb.nr_hits, stlb.nr_hits, nr_tlb_walks, tlb_cycles);
+	}
+
+	if (nr_pwc_entries) {
+		unsigned long nr_lookups = nr_pwc_hits + nr_pwc_misses;
+
+		fprintf(stderr, "PWC %lu hits, %lu misses (%.1f%% hit), %lu walk references\n",
+				nr_pwc_hits, nr_pwc_misses,
+				nr_lookups ? 100.0 * nr_pwc_hits / nr_lookups : 0.0,
+				nr_walk_refs);
+	}
+
+	if (nr_asids) {
+		fprintf(stderr, "asid %u, %lu flushes, %lu flushes avoided, %lu rollovers\n",
+				current->asid, nr_tlb_flushes, nr_tlb_flushes_avoided,
+				nr_asid_rollovers);
 	}
 }
 
-static void __print_usage(const char * name)
+static void __show_swap(void)
 {
-	printf("Usage: %s {-q} {-f [workload file]}\n", name);
-	printf("\n");
-	printf("  -q: Run quietly\n\n");
+	fprintf(stderr, "%u/%u swap slots in use, %lu swap-outs, %lu swap-ins\n",
+			nr_swap_slots - nr_free_swap_slots, nr_swap_slots,
+			nr_swap_outs, nr_swap_ins);
+	if (swap_file) {
+		fprintf(stderr, "%lu pages written in %lu batches, %lu pages read\n",
+				nr_swap_pages_written, nr_swap_batches, nr_swap_pages_read);
+	}
+	fprintf(stderr, "%lu major faults, %lu minor faults\n",
+			nr_major_faults, nr_minor_faults);
 }
 
-int main(int argc, char * argv[])
+static void __show_buddyinfo(void)
 {
-	int opt;
-	FILE *input = stdin;
+	unsigned long nr_ops = nr_buddy_allocs + nr_buddy_frees;
 
-	while ((opt = getopt(argc, argv, "qht")) != -1) {
-		switch (opt) {
-		case 'q':
-			verbose = false;
-			break;
-		case 't':
-			print_tlb_result = true;
-			break;
-		case 'h':
-		default:
-			__print_usage(argv[0]);
-			return EXIT_FAILURE;
-		}
+	fprintf(stderr, "order    ");
+	for (unsigned int order = 0; order < nr_buddy_orders; order++) {
+		fprintf(stderr, " %6u", order);
 	}
-
-	if (verbose && !argv[optind]) {
-		printf("***************************************************************************\n");
-		printf(" __      ____  __     _____ _                 _       _\n");
-		printf(" \\ \\    / /  \\/  |   / ____(_)               | |     | |\n");
-		printf("  \\ \\  / /| \\  / |  | (___  _ _ __ ___  _   _| | __ _| |_ ___  _ __ \n");
-		printf("   \\ \\/ / | |\\/| |   \\___ \\| | '_ ` _ \\| | | | |/ _` | __/ _ \\| '__|\n");
-		printf("    \\  /  | |  | |   ____) | | | | | | | |_| | | (_| | || (_) | |   \n");
-		printf("     \\/   |_|  |_|  |_____/|_|_| |_| |_|\\__,_|_|\\__,_|\\__\\___/|_|\n");
-		printf("\n");
-		printf("                                            >> SCE213 2021 Fall <<\n");
-		printf("\n");
-		printf("***************************************************************************\n");
+	fprintf(stderr, "\nfree     ");
+	for (unsigned int order = 0; order < nr_buddy_orders; order++) {
+		fprintf(stderr, " %6lu", nr_free_blocks(order));
 	}
+	fprintf(stderr, "\nunusable ");
+	for (unsigned int order = 0; order < nr_buddy_orders; order++) {
+		fprintf(stderr, " %6.3f", unusable_index(order) / 1000.0);
+	}
+	fprintf(stderr, "\nfragindex");
+	for (unsigned int order = 0; order < nr_buddy_orders; order++) {
+		fprintf(stderr, " %6.3f", fragmentation_index(order) / 1000.0);
+	}
+	fprintf(stderr, "\n%lu allocations, %lu frees, %lu steps (%.2f per operation)\n",
+			nr_buddy_allocs, nr_buddy_frees, nr_buddy_steps,
+			nr_ops ? (double)nr_buddy_steps / nr_ops : 0.0);
+	if (nr_compactions) {
+		fprintf(stderr, "%lu compactions, %lu frames moved, %lu frames scanned, %lu PTEs updated\n",
+				nr_compactions, nr_compact_moved, nr_compact_scanned, nr_compact_ptes);
+	}
+}
 
-	if (argv[optind]) {
-		if (verbose) printf("Use file \"%s\" for input.\n", argv[optind]);
+static void __compact(void)
+{
+	unsigned long nr_moved = nr_compact_moved;
+	unsigned long nr_scanned = nr_compact_scanned;
+	unsigned long nr_ptes = nr_compact_ptes;
+	int order;
+
+	compact_memory(-1);
+
+	order = largest_free_order();
+	fprintf(stderr, "%lu frames moved, %lu frames scanned, %lu PTEs updated, "
+			"largest free block %lu frames\n",
+			nr_compact_moved - nr_moved, nr_compact_scanned - nr_scanned,
+			nr_compact_ptes - nr_ptes, order < 0 ? 0 : 1UL << order);
+}
 
-		input = fopen(argv[optind], "r");
-		if (!input) {
-			fprintf(stderr, "No input file %s\n", argv[optind]);
-			return EXIT_FAILURE;
-		}
-		verbose = false;
-	} else {
-		if (verbose) printf("Use stdin for input.\n");
+static void __collapse_huge_pages(void)
+{
+	unsigned long nr_scanned = nr_thp_scanned;
+	unsigned int nr_promoted;
+
+	if (!__huge_tlb_supported()) return;
+
+	nr_promoted = collapse_huge_pages();
+
+	fprintf(stderr, "%lu page directories scanned, %u promoted\n",
+			nr_thp_scanned - nr_scanned, nr_promoted);
+}
+
+static void __show_thp_of(struct process *p)
+{
+	fprintf(stderr, "%5u: %lu promotions, %lu demotions, %lu TLB misses saved\n",
+			p->pid, p->nr_thp_promotions, p->nr_thp_demotions,
+			p->nr_huge_tlb_saved);
+}
+
+static void __show_thp(void)
+{
+	struct process *p;
+
+	__show_thp_of(current);
+	list_for_each_entry(p, &processes, list) {
+		__show_thp_of(p);
 	}
+}
 
-	if (verbose) {
-		printf("Enter 'help' or '?' for help.\n\n");
-		printf(">> ");
+/* Size of a PTE before it was packed into a word */
+#define UNPACKED_PTE_SIZE	12
+
+struct footprint {
+	unsigned int nr_nodes;
+	unsigned int nr_pds;
+	unsigned int nr_shared;
+	unsigned int nr_ptes;
+};
+
+static void __count_footprint(struct pt_entry *pde, unsigned long vpn, void *data)
+{
+	struct footprint *f = data;
+
+	/* A huge page takes a single PTE in the upper level */
+	if (pde->huge) {
+		f->nr_ptes++;
+		return;
 	}
 
-	__do_simulation(input);
+	if (pde->shared) f->nr_shared++;
+	f->nr_ptes += pde->nr_used;
+}
+
+static inline size_t __footprint_bytes(struct footprint *f, size_t pte_size)
+{
+	return f->nr_nodes * pt_node_cache.size + (f->nr_pds * pte_size << pt_bits);
+}
 
-	if (input != stdin) fclose(input);
+static unsigned int __count_hptes(struct process *p)
+{
+	unsigned int nr_entries = 0;
 
-	return EXIT_SUCCESS;
+	for (unsigned long i = 0; i < (1UL << hpt_shift); i++) {
+		for (struct hpte *h = hpt_anchors[i]; h; h = h->next) {
+			if (h->id == p->pagetable.id) nr_entries++;
+		}
+	}
+	return nr_entries;
+}
+
+static void __show_footprint_of(struct process *p, struct footprint *total)
+{
+	struct footprint f = { 0 };
+
+	if (pt_format == PT_HASHED) {
+		f.nr_ptes = __count_hptes(p);
+
+		fprintf(stderr, "%5u: %3u entries, %5zu bytes\n",
+				p->pid, f.nr_ptes, f.nr_ptes * sizeof(struct hpte));
+		return;
+	}
+
+	count_pt_nodes(&p->pagetable, &f.nr_nodes, &f.nr_pds);
+	for_each_pd(&p->pagetable, __count_footprint, &f);
+
+	fprintf(stderr, "%5u: %2u nodes, %2u directories (%u shared), %3u PTEs, %5zu bytes (%zu bytes unpacked)\n",
+			p->pid, f.nr_nodes, f.nr_pds, f.nr_shared, f.nr_ptes,
+			__footprint_bytes(&f, sizeof(struct pte)),
+			__footprint_bytes(&f, UNPACKED_PTE_SIZE));
+
+	total->nr_nodes += f.nr_nodes;
+	total->nr_pds += f.nr_pds;
+}
+
+static void __show_footprint(void)
+{
+	struct process *p;
+	unsigned int nr_procs = 1;
+	struct footprint total = { 0 };
+
+	__show_footprint_of(current, &total);
+	list_for_each_entry(p, &processes, list) {
+		__show_footprint_of(p, &total);
+		nr_procs++;
+	}
+
+	if (pt_format == PT_HASHED) {
+		fprintf(stderr, "%u processes, hashed page table, %u anchors, %zu-byte entries, %zu bytes\n",
+				nr_procs, 1U << hpt_shift, sizeof(struct hpte),
+				(sizeof(struct hpte *) << hpt_shift) +
+				hpt_nr_entries * sizeof(struct hpte));
+	} else {
+		fprintf(stderr, "%u processes, %u-level page tables, %zu-byte PTEs, %zu bytes (%zu bytes unpacked)\n",
+				nr_procs, pt_levels, sizeof(struct pte),
+				__footprint_bytes(&total, sizeof(struct pte)),
+				__footprint_bytes(&total, UNPACKED_PTE_SIZE));
+	}
+	if (nr_forks) {
+		fprintf(stderr, "%lu forks, %lu page table entries visited\n",
+				nr_forks, nr_fork_pt_visits);
+	}
+}
+
+static void __show_slabinfo_of(struct kmem_cache *cache)
+{
+	unsigned long nr_free = cache->nr_objs - cache->nr_active;
+
+	fprintf(stderr, "%-14s %6lu %6lu %7zu %5lu %8lu %8lu %5.1f%% %7lu\n",
+			cache->name, cache->nr_active, cache->nr_objs, cache->objsize,
+			cache->nr_slabs, cache->nr_allocs, cache->nr_frees,
+			cache->nr_objs ? 100.0 * nr_free / cache->nr_objs : 0.0,
+			cache->nr_active * (cache->objsize - cache->size));
+}
+
+static void __show_slabinfo(void)
+{
+	fprintf(stderr, "# name         active   objs objsize slabs   allocs    frees  free%% padding\n");
+	__show_slabinfo_of(&pte_directory_cache);
+	__show_slabinfo_of(&pt_node_cache);
+	if (pt_format == PT_HASHED) __show_slabinfo_of(&hpte_cache);
+	__show_slabinfo_of(&process_cache);
+}
+
+static void __show_batch_summary(void)
+{
+	fprintf(stderr, "%lu accesses (%lu failed), %lu allocations, %lu frees, %lu forks\n",
+			nr_reads + nr_writes, nr_failed_accesses,
+			nr_allocs, nr_frees, nr_forks);
+	if (print_tlb_result) {
+		fprintf(stderr, "%lu TLB hits, %lu TLB misses, %lu cycles\n",
+				dtlb.nr_hits + stlb.nr_hits, nr_tlb_walks, tlb_cycles);
+	}
+	fprintf(stderr, "%lu major faults, %lu minor faults\n",
+			nr_major_faults, nr_minor_faults);
+}
+
+/**
+ * Counters of the simulation, grouped by what they count
+ */
+struct stat_entry {
+	const char *group;
+	const char *name;
+	unsigned long value;
+};
+
+#define MAX_NR_STATS	24
+
+static unsigned int __collect_stats(struct stat_entry stats[])
+{
+	unsigned int nr_stats = 0;
+
+#define STAT(g, n, v)	stats[nr_stats++] = (struct stat_entry){ g, n, v }
+	STAT("accesses", "reads", nr_reads);
+	STAT("accesses", "writes", nr_writes);
+	STAT("accesses", "failed", nr_failed_accesses);
+	STAT("tlb", "hits", dtlb.nr_hits + stlb.nr_hits);
+	STAT("tlb", "misses", nr_tlb_walks);
+	STAT("tlb", "flushes", nr_tlb_flushes);
+	STAT("walks", "page_walks", nr_page_walks);
+	STAT("walks", "references", nr_walk_refs);
+	STAT("faults", "missing_directory", nr_pd_faults);
+	STAT("faults", "invalid_pte", nr_pte_faults);
+	STAT("faults", "write_protect", nr_wp_faults);
+	STAT("faults", "major", nr_major_faults);
+	STAT("faults", "minor", nr_minor_faults);
+	STAT("cow", "copies", nr_cow_copies);
+	STAT("processes", "forks", nr_forks);
+	STAT("processes", "switches", nr_switches);
+	STAT("frames", "total", nr_pageframes);
+	STAT("frames", "in_use", nr_pageframes - nr_free_frames);
+	STAT("frames", "max_in_use", max_frames_in_use);
+#undef STAT
+
+	assert(nr_stats <= MAX_NR_STATS);
+	return nr_stats;
+}
+
+static void __show_stats(void)
+{
+	struct stat_entry stats[MAX_NR_STATS];
+	unsigned int nr_stats = __collect_stats(stats);
+
+	for (unsigned int i = 0; i < nr_stats; i++) {
+		bool first = i == 0 || strcmp(stats[i].group, stats[i - 1].group);
+
+		if (first) {
+			fprintf(stderr, "%s%-10s", i ? "\n" : "", stats[i].group);
+		}
+		fprintf(stderr, "%s %s %lu", first ? "" : ",", stats[i].name, stats[i].value);
+	}
+	fprintf(stderr, "\n");
+}
+
+/**
+ * __dump_stats_json(@path)
+ *
+ * DESCRIPTION
+ *   Write the counters to @path as a JSON object of the groups, each of which
+ *   is an object of the counters in the group.
+ *
+ * RETURN
+ *   0 on success
+ *   -1 on error
+ */
+static int __dump_stats_json(const char *path)
+{
+	struct stat_entry stats[MAX_NR_STATS];
+	unsigned int nr_stats = __collect_stats(stats);
+	FILE *output = strcmp(path, "-") ? fopen(path, "w") : stdout;
+
+	if (!output) {
+		fprintf(stderr, "Unable to open statistics file %s\n", path);
+		return -1;
+	}
+
+	fprintf(output, "{");
+	for (unsigned int i = 0; i < nr_stats; i++) {
+		bool first = i == 0 || strcmp(stats[i].group, stats[i - 1].group);
+
+		if (first) {
+			fprintf(output, "%s\n  \"%s\": {", i ? "\n  }," : "", stats[i].group);
+		}
+		fprintf(output, "%s\n    \"%s\": %lu", first ? "" : ",",
+				stats[i].name, stats[i].value);
+	}
+	fprintf(output, "%s\n}\n", nr_stats ? "\n  }" : "");
+
+	if (output == stdout) return fflush(stdout) ? -1 : 0;
+
+	if (ferror(output) | fclose(output)) {
+		fprintf(stderr, "Unable to write statistics file %s\n", path);
+		return -1;
+	}
+	return 0;
+}
+
+static void __print_help(void)
+{
+	printf("  help | ?     : Print out this help message \n");
+	printf("  exit         : Exit the simulation\n");
+	printf("\n");
+	printf("  switch [pid] : Do context switch to pid @pid\n");
+	printf("                 Fork @pid if there is no process with the pid\n");
+	printf("  show         : Show the page table of the current process\n");
+	printf("  pages        : Show the status for each page frame\n");
+	printf("  pages [from] [to] : Show the status for page frames in [@from, @to)\n");
+	printf("  pages summary     : Summarize the status of page frames\n");
+	printf("  tlb          : Show TLB entries\n");
+	printf("  swap         : Show the swap and page fault statistics\n");
+	printf("  footprint    : Show the page table memory of each process\n");
+	printf("  slabinfo     : Show the object caches for page tables and processes\n");
+	printf("  buddyinfo    : Show the free blocks and the fragmentation of page frames\n");
+	printf("  compact      : Migrate in-use page frames to make free page frames contiguous\n");
+	printf("  khugepaged   : Promote populated page directories to transparent huge pages\n");
+	printf("  thp          : Show the huge page promotions, demotions, and TLB misses\n");
+	printf("                 saved for each process\n");
+	printf("  stats        : Show the counters of accesses, TLB, page walks, faults,\n");
+	printf("                 processes, and page frames\n");
+	printf("\n");
+	printf("  alloc [vpn] r|w  : Allocate a page for the rw flag\n");
+	printf("  halloc [vpn] r|w : Allocate a huge page of contiguous page frames\n");
+	printf("                     for the page directory at VPN @vpn\n");
+	printf("  free [vpn]       : Deallocate the page at VPN @vpn, or the huge\n");
+	printf("                     page covering @vpn. A transparent huge page is\n");
+	printf("                     split to free the page only\n");
+	printf("  access [vpn] r|w : Access VPN @vpn for read or write\n");
+	printf("  read [vpn]       : Equivalent to access @vpn r\n");
+	printf("  write [vpn]      : Equivalent to access @vpn w\n");
+	printf("\n");
+}
+
+/**
+ * Commands of the simulation. A command is looked up by its name and the
+ * number of its arguments, and returns @false to end the simulation.
+ * The commands changing the state of the simulation are recorded in binary
+ * traces as @trace_op. The access type of the record is @rw, or the second
+ * argument if @rw is 0.
+ */
+struct command {
+	const char *name;
+	int nr_args;
+	bool (*run)(const struct token *args);
+	unsigned int trace_op;
+	unsigned int rw;
+};
+
+static bool __cmd_exit(const struct token *args)
+{
+	return false;
+}
+
+static bool __cmd_help(const struct token *args)
+{
+	__print_help();
+	return true;
+}
+
+static bool __cmd_show(const struct token *args)
+{
+	__show_pagetable();
+	return true;
+}
+
+static bool __cmd_pages(const struct token *args)
+{
+	__show_pageframes(0, nr_pageframes);
+	return true;
+}
+
+static bool __cmd_pages_summary(const struct token *args)
+{
+	if (!token_is(&args[0], "summary")) {
+		printf("Unknown command pages\n");
+		return true;
+	}
+	__show_pageframes_summary();
+	return true;
+}
+
+static bool __cmd_pages_range(const struct token *args)
+{
+	__show_pageframes(token_to_ulong(&args[0]), token_to_ulong(&args[1]));
+	return true;
+}
+
+static bool __cmd_tlb(const struct token *args)
+{
+	__show_tlb();
+	return true;
+}
+
+static bool __cmd_swap(const struct token *args)
+{
+	__show_swap();
+	return true;
+}
+
+static bool __cmd_footprint(const struct token *args)
+{
+	__show_footprint();
+	return true;
+}
+
+static bool __cmd_slabinfo(const struct token *args)
+{
+	__show_slabinfo();
+	return true;
+}
+
+static bool __cmd_buddyinfo(const struct token *args)
+{
+	__show_buddyinfo();
+	return true;
+}
+
+static bool __cmd_compact(const struct token *args)
+{
+	__compact();
+	return true;
+}
+
+static bool __cmd_khugepaged(const struct token *args)
+{
+	__collapse_huge_pages();
+	return true;
+}
+
+static bool __cmd_thp(const struct token *args)
+{
+	__show_thp();
+	return true;
+}
+
+static bool __cmd_stats(const struct token *args)
+{
+	__show_stats();
+	return true;
+}
+
+static bool __cmd_switch(const struct token *args)
+{
+	__switch_process(token_to_ulong(&args[0]));
+	return true;
+}
+
+static bool __cmd_free(const struct token *args)
+{
+	__free_page(token_to_ulong(&args[0]));
+	return true;
+}
+
+static bool __cmd_read(const struct token *args)
+{
+	__access_memory(token_to_ulong(&args[0]), RW_READ);
+	return true;
+}
+
+static bool __cmd_write(const struct token *args)
+{
+	__access_memory(token_to_ulong(&args[0]), RW_WRITE);
+	return true;
+}
+
+static bool __cmd_alloc(const struct token *args)
+{
+	return __alloc_page(token_to_ulong(&args[0]), token_to_rwflag(&args[1]));
+}
+
+static bool __cmd_halloc(const struct token *args)
+{
+	__alloc_huge_page(token_to_ulong(&args[0]), token_to_rwflag(&args[1]));
+	return true;
+}
+
+static bool __cmd_access(const struct token *args)
+{
+	__access_memory(token_to_ulong(&args[0]), token_to_rwflag(&args[1]));
+	return true;
+}
+
+static const struct command commands[] = {
+	{ "exit",	0, __cmd_exit },
+	{ "help",	0, __cmd_help },
+	{ "?",		0, __cmd_help },
+	{ "show",	0, __cmd_show },
+	{ "pages",	0, __cmd_pages },
+	{ "pages",	1, __cmd_pages_summary },
+	{ "pages",	2, __cmd_pages_range },
+	{ "tlb",	0, __cmd_tlb },
+	{ "swap",	0, __cmd_swap },
+	{ "footprint",	0, __cmd_footprint },
+	{ "slabinfo",	0, __cmd_slabinfo },
+	{ "buddyinfo",	0, __cmd_buddyinfo },
+	{ "compact",	0, __cmd_compact },
+	{ "khugepaged",	0, __cmd_khugepaged },
+	{ "thp",	0, __cmd_thp },
+	{ "stats",	0, __cmd_stats },
+	{ "switch",	1, __cmd_switch, TRACE_SWITCH },
+	{ "s",		1, __cmd_switch, TRACE_SWITCH },
+	{ "free",	1, __cmd_free, TRACE_FREE },
+	{ "f",		1, __cmd_free, TRACE_FREE },
+	{ "read",	1, __cmd_read, TRACE_ACCESS, RW_READ },
+	{ "r",		1, __cmd_read, TRACE_ACCESS, RW_READ },
+	{ "write",	1, __cmd_write, TRACE_ACCESS, RW_WRITE },
+	{ "w",		1, __cmd_write, TRACE_ACCESS, RW_WRITE },
+	{ "alloc",	2, __cmd_alloc, TRACE_ALLOC },
+	{ "a",		2, __cmd_alloc, TRACE_ALLOC },
+	{ "halloc",	2, __cmd_halloc, TRACE_HALLOC },
+	{ "access",	2, __cmd_access, TRACE_ACCESS },
+};
+
+#define NR_COMMANDS	(sizeof(commands) / sizeof(commands[0]))
+
+/**
+ * The commands are chained by the first character of their names, so that
+ * a command is told apart with a few comparisons. The chains are indexed
+ * from 1, and 0 ends a chain.
+ */
+static unsigned char command_heads[256];
+static unsigned char command_next[NR_COMMANDS];
+
+static void __init_commands(void)
+{
+	for (int i = NR_COMMANDS - 1; i >= 0; i--) {
+		unsigned char c = commands[i].name[0];
+
+		command_next[i] = command_heads[c];
+		command_heads[c] = i + 1;
+	}
+}
+
+static const struct command *__find_command(const struct token *name, int nr_args)
+{
+	unsigned char c = tolower(name->str[0]);
+
+	for (unsigned int i = command_heads[c]; i; i = command_next[i - 1]) {
+		const struct command *cmd = commands + i - 1;
+
+		if (cmd->nr_args == nr_args && token_is(name, cmd->name)) return cmd;
+	}
+	return NULL;
+}
+
+/**
+ * __run_command(@tokens, @nr_tokens)
+ *
+ * RETURN
+ *   @false if the simulation should end
+ *   @true otherwise
+ */
+static bool __run_command(const struct token *tokens, int nr_tokens)
+{
+	const struct command *cmd;
+
+	if (nr_tokens > 3) assert(!"Unknown command in trace");
+
+	cmd = __find_command(&tokens[0], nr_tokens - 1);
+	if (!cmd) {
+		printf("Unknown command ");
+		for (unsigned int i = 0; i < tokens[0].len; i++) {
+			putchar(tolower(tokens[0].str[i]));
+		}
+		printf("\n");
+		return true;
+	}
+	return cmd->run(tokens + 1);
+}
+
+/**
+ * __make_record(@nr_tokens, @tokens, @record)
+ *
+ * DESCRIPTION
+ *   Translate the command in @tokens into @record of the binary trace as
+ *   @commands describes it.
+ *
+ * RETURN
+ *   1 if translated
+ *   0 if the command is not recorded in the binary trace
+ *   -1 if the command ends the simulation
+ */
+static int __make_record(int nr_tokens, const struct token tokens[], struct trace_record *record)
+{
+	const struct command *cmd = __find_command(&tokens[0], nr_tokens - 1);
+	unsigned int rw;
+
+	if (!cmd) return 0;
+	if (cmd->run == __cmd_exit) return -1;
+	if (!cmd->trace_op) return 0;
+
+	if (cmd->rw) {
+		rw = cmd->rw;
+	} else {
+		rw = cmd->nr_args > 1 ? token_to_rwflag(&tokens[2]) : 0;
+	}
+	*record = make_trace_record(cmd->trace_op, rw, token_to_ulong(&tokens[1]));
+	return 1;
+}
+
+/**
+ * __simulate(@pos, @end, @nr_commands)
+ *
+ * DESCRIPTION
+ *   Run the commands in [@pos, @end) line by line. @nr_commands counts the
+ *   commands run so far for the periodic khugepaged scan.
+ *
+ * RETURN
+ *   @false if the simulation should end
+ *   @true otherwise
+ */
+static bool __simulate(const char *pos, const char *end, unsigned long *nr_commands)
+{
+	struct token tokens[MAX_NR_TOKENS];
+	int nr_tokens;
+
+	while (scan_command(&pos, end, &nr_tokens, tokens)) {
+		if (nr_tokens == 0) continue;
+
+		if (!__run_command(tokens, nr_tokens)) return false;
+
+		if (thp_scan_interval && ++(*nr_commands) % thp_scan_interval == 0) {
+			collapse_huge_pages();
+		}
+
+		if (verbose) printf(">> ");
+	}
+	return true;
+}
+
+/**
+ * __do_simulation(@input)
+ *
+ * DESCRIPTION
+ *   Run the simulation with the commands from @input. A regular file is
+ *   mapped into the memory and scanned in place. Otherwise, the commands are
+ *   read line by line.
+ */
+static void __do_simulation(FILE *input)
+{
+	char command[MAX_COMMAND_LEN] = { 0 };
+	unsigned long nr_commands = 0;
+	struct stat st;
+
+	__init_system();
+	__init_commands();
+
+	if (!fstat(fileno(input), &st) && S_ISREG(st.st_mode) && st.st_size > 0) {
+		const char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE,
+				fileno(input), 0);
+
+		if (map != MAP_FAILED) {
+			madvise((void *)map, st.st_size, MADV_SEQUENTIAL);
+			__simulate(map, map + st.st_size, &nr_commands);
+			munmap((void *)map, st.st_size);
+			return;
+		}
+	}
+
+	while (fgets(command, sizeof(command), input)) {
+		if (!__simulate(command, command + strlen(command), &nr_commands)) break;
+	}
+}
+
+/**
+ * __replay_records(@records, @nr_records, @nr_replayed)
+ *
+ * DESCRIPTION
+ *   Feed @nr_records records to the simulation without parsing, as the
+ *   equivalent text commands are. @nr_replayed counts the records replayed
+ *   so far for the periodic khugepaged scan.
+ *
+ * RETURN
+ *   @false if the simulation should end
+ *   @true otherwise
+ */
+static bool __replay_records(const struct trace_record *records, size_t nr_records,
+		unsigned long *nr_replayed)
+{
+	for (size_t i = 0; i < nr_records; i++) {
+		const struct trace_record *r = records + i;
+		unsigned long arg = trace_arg(r);
+
+		switch (trace_op(r)) {
+		case TRACE_ALLOC:
+			if (!__alloc_page(arg, trace_rw(r))) return false;
+			break;
+		case TRACE_HALLOC:
+			__alloc_huge_page(arg, trace_rw(r));
+			break;
+		case TRACE_FREE:
+			__free_page(arg);
+			break;
+		case TRACE_ACCESS:
+			__access_memory(arg, trace_rw(r));
+			break;
+		case TRACE_SWITCH:
+			__switch_process(arg);
+			break;
+		default:
+			assert(!"Unknown record in trace");
+		}
+
+		if (thp_scan_interval && ++*nr_replayed % thp_scan_interval == 0) {
+			collapse_huge_pages();
+		}
+	}
+	return true;
+}
+
+/**
+ * __replay_trace(@trace)
+ *
+ * DESCRIPTION
+ *   Run the simulation through the records of the binary trace @trace, which
+ *   is mapped into the memory.
+ */
+static void __replay_trace(struct trace *trace)
+{
+	unsigned long nr_replayed = 0;
+
+	__init_system();
+	__replay_records(trace->records, trace->nr_records, &nr_replayed);
+}
+
+/* Records of the synthetic workload generated at a time */
+#define NR_GEN_RECORDS	4096
+
+/**
+ * __replay_workload(@gen)
+ *
+ * DESCRIPTION
+ *   Run the simulation through the synthetic workload of @gen, generating
+ *   the records chunk by chunk as they are replayed.
+ */
+static void __replay_workload(struct generator *gen)
+{
+	struct trace_record records[NR_GEN_RECORDS];
+	unsigned long nr_replayed = 0;
+	size_t nr_records;
+
+	__init_system();
+
+	while ((nr_records = generate_records(gen, records, NR_GEN_RECORDS))) {
+		if (!__replay_records(records, nr_records, &nr_replayed)) break;
+	}
+}
+
+/**
+ * __parse_number(@option, @arg, @min, @max, @result)
+ *
+ * DESCRIPTION
+ *   Parse @arg given to --@option, which should be a number from @min to
+ *   @max, into @result.
+ *
+ * RETURN
+ *   0 on success
+ *   -1 otherwise, after printing the error
+ */
+static int __parse_number(const char *option, const char *arg,
+		unsigned int min, unsigned int max, unsigned int *result)
+{
+	unsigned long value;
+
+	if (parse_ulong(arg, max, &value) || value < min) {
+		fprintf(stderr, "--%s takes a number from %u to %u\n", option, min, max);
+		return -1;
+	}
+	*result = value;
+	return 0;
+}
+
+static void __print_usage(const char * name)
+{
+	printf("Usage: %s {-q} {-t} {options} {[workload file]}\n", name);
+	printf("\n");
+	printf("  -q: Run quietly\n");
+	printf("  -t: Translate through the TLB and print the TLB results\n\n");
+	printf("  The workload file may be a binary trace, which is replayed through mmap().\n\n");
+	printf("  --gen [workload]   : Generate the synthetic workload instead of reading the\n");
+	printf("                       workload file. The workload is a pattern followed by\n");
+	printf("                       comma-separated parameters, e.g., zipf,length=100000\n");
+	printf("                       Patterns: seq, strided, uniform (default), zipf,\n");
+	printf("                                 phase, and fork\n");
+	printf("                       length=n : Number of accesses (default 10000)\n");
+	printf("                       seed=n   : Seed of the random numbers (default 1)\n");
+	printf("                       pages=n  : Pages allocated from VPN 0 (default 32)\n");
+	printf("                       procs=n  : Number of processes (default 1, 8 for fork)\n");
+	printf("                       switch=n : Switch to a random process every @n accesses\n");
+	printf("                       write=n  : Percentage of writes (default 30)\n");
+	printf("                       stride=n : Stride of strided in pages (default 8)\n");
+	printf("                       skew=x   : Exponent of zipf (default 0.99)\n");
+	printf("                       hot=n    : Working set of phase in pages (default 1/4)\n");
+	printf("                       period=n : Accesses of each phase (default 1/8)\n");
+	printf("                       With --convert, the workload is written to the trace\n");
+	printf("                       instead of simulated\n\n");
+	printf("  --batch            : Print the aggregates at the end instead of the result\n");
+	printf("                       of each access, allocation, and free\n");
+	printf("  --output-buffer [n]: Buffer the results in @n-KiB blocks instead of writing\n");
+	printf("                       each of them to the unbuffered stderr\n");
+	printf("  --stats-json [path]: Dump the counters in JSON to @path (- for stdout) at exit\n");
+	printf("  --convert [path]   : Convert the text workload into the binary trace at\n");
+	printf("                       @path, and exit without simulating\n\n");
+	printf("  --tlb-sets [n]     : Number of TLB sets (power of 2, default 1)\n");
+	printf("  --tlb-ways [n]     : Number of ways per TLB set (default %d)\n", NR_TLB_ENTRIES);
+	printf("  --tlb-policy [name]: TLB replacement policy;\n");
+	printf("                       fifo (default), lru, plru, random, or clock\n");
+	printf("  --asids [n]        : Tag the TLB with @n ASIDs instead of flushing it\n");
+	printf("                       on context switches (up to %d)\n", MAX_NR_ASIDS);
+	printf("  --stlb-sets [n]    : Number of L2 TLB sets (power of 2, default 1)\n");
+	printf("  --stlb-ways [n]    : Number of ways per L2 TLB set. Enables the L2 TLB\n");
+	printf("  --stlb-policy [name]: L2 TLB replacement policy (default lru)\n");
+	printf("  --tlb-fill [inclusive|exclusive]: Fill policy of the TLB hierarchy\n");
+	printf("  --tlb-latency [n]  : Cycles to probe the L1 TLB (default %u)\n", dtlb.latency);
+	printf("  --stlb-latency [n] : Cycles to probe the L2 TLB (default %u)\n", stlb.latency);
+	printf("  --walk-latency [n] : Cycles per memory reference of page walks (default %u)\n", walk_latency);
+	printf("  --pwc [n]          : Cache @n outer page table entries in the page-walk cache\n");
+	printf("                       (up to %d)\n\n", MAX_PWC_ENTRIES);
+	printf("  --frames [n]       : Number of physical page frames (default %d)\n", NR_PAGEFRAMES);
+	printf("  --swap [n]         : Evict pages to @n swap slots when the memory is full\n");
+	printf("  --reclaim [name]   : Page replacement policy; fifo, clock (default), or lru\n");
+	printf("  --swap-file [path] : Back the swap area with the file at @path\n");
+	printf("  --auto-compact     : Compact the memory when contiguous page frames run out\n");
+	printf("  --thp [n]          : Promote a page directory to a transparent huge page\n");
+	printf("                       once @n of its pages are allocated\n");
+	printf("  --thp-scan [n]     : Run khugepaged every @n commands\n\n");
+	printf("  --lazy-fork        : Share page directories on fork until written\n");
+	printf("  --pt-levels [n]    : Number of page table levels (default %d)\n", NR_PT_LEVELS);
+	printf("  --pt-bits [n]      : VPN bits indexing each level (default %d); the VPN\n", PTES_PER_PAGE_SHIFT);
+	printf("                       has up to %d bits in total\n", MAX_VPN_BITS);
+	printf("  --pt-format [fmt]  : Page table format (radix, hashed). Lazy fork\n");
+	printf("                       works with the radix page table only\n\n");
+}
+
+static const struct option long_options[] = {
+	{ "batch", no_argument, NULL, 'Q' },
+	{ "convert", required_argument, NULL, 'V' },
+	{ "gen", required_argument, NULL, 'G' },
+	{ "stats-json", required_argument, NULL, 'J' },
+	{ "output-buffer", required_argument, NULL, 'U' },
+	{ "tlb-sets", required_argument, NULL, 'S' },
+	{ "tlb-ways", required_argument, NULL, 'W' },
+	{ "tlb-policy", required_argument, NULL, 'P' },
+	{ "asids", required_argument, NULL, 'A' },
+	{ "stlb-sets", required_argument, NULL, 's' },
+	{ "stlb-ways", required_argument, NULL, 'w' },
+	{ "stlb-policy", required_argument, NULL, 'p' },
+	{ "tlb-fill", required_argument, NULL, 'F' },
+	{ "tlb-latency", required_argument, NULL, 'l' },
+	{ "stlb-latency", required_argument, NULL, 'L' },
+	{ "walk-latency", required_argument, NULL, 'K' },
+	{ "pwc", required_argument, NULL, 'C' },
+	{ "frames", required_argument, NULL, 'M' },
+	{ "swap", required_argument, NULL, 'X' },
+	{ "reclaim", required_argument, NULL, 'R' },
+	{ "swap-file", required_argument, NULL, 'B' },
+	{ "auto-compact", no_argument, NULL, 'c' },
+	{ "thp", required_argument, NULL, 'H' },
+	{ "thp-scan", required_argument, NULL, 'Y' },
+	{ "lazy-fork", no_argument, NULL, 'Z' },
+	{ "pt-levels", required_argument, NULL, 'T' },
+	{ "pt-bits", required_argument, NULL, 'b' },
+	{ "pt-format", required_argument, NULL, 'O' },
+	{ 0 },
+};
+
+int main(int argc, char * argv[])
+{
+	int opt;
+	FILE *input = stdin;
+	const char *convert_path = NULL;
+	struct trace trace = { 0 };
+	/* The workload is text commands, not a binary trace or a generated one */
+	int text_input = 1;
+	int ret = EXIT_SUCCESS;
+	struct gen_params gen;
+	struct generator generator;
+	bool generate = false;
+
+	while ((opt = getopt_long(argc, argv, "qht", long_options, NULL)) != -1) {
+		switch (opt) {
+		case 'q':
+			verbose = false;
+			break;
+		case 't':
+			print_tlb_result = true;
+			break;
+		case 'Q':
+			batch = true;
+			break;
+		case 'V':
+			convert_path = optarg;
+			break;
+		case 'J':
+			stats_json_path = optarg;
+			break;
+		case 'G':
+			if (parse_gen_params(optarg, &gen)) return EXIT_FAILURE;
+			generate = true;
+			break;
+		case 'U':
+			output_block_kb = strtoimax(optarg, NULL, 0);
+			break;
+		case 'S':
+			if (__parse_number("tlb-sets", optarg, 1, MAX_TLB_ENTRIES, &tlb_sets)) {
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'W':
+			if (__parse_number("tlb-ways", optarg, 1, MAX_TLB_ENTRIES, &tlb_ways)) {
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'P':
+			tlb_policy = optarg;
+			break;
+		case 'A':
+			if (__parse_number("asids", optarg, 1, MAX_NR_ASIDS, &nr_asids)) {
+				return EXIT_FAILURE;
+			}
+			break;
+		case 's':
+			if (__parse_number("stlb-sets", optarg, 1, MAX_TLB_ENTRIES, &stlb_sets)) {
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'w':
+			if (__parse_number("stlb-ways", optarg, 1, MAX_TLB_ENTRIES, &stlb_ways)) {
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'p':
+			stlb_policy = optarg;
+			break;
+		case 'F':
+			if (strcmp(optarg, "exclusive") == 0) {
+				tlb_exclusive = true;
+			} else if (strcmp(optarg, "inclusive") == 0) {
+				tlb_exclusive = false;
+			} else {
+				__print_usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'l':
+			if (__parse_number("tlb-latency", optarg, 0, MAX_LATENCY, &dtlb.latency)) {
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'L':
+			if (__parse_number("stlb-latency", optarg, 0, MAX_LATENCY, &stlb.latency)) {
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'K':
+			if (__parse_number("walk-latency", optarg, 0, MAX_LATENCY, &walk_latency)) {
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'C':
+			if (__parse_number("pwc", optarg, 1, MAX_PWC_ENTRIES, &nr_pwc_entries)) {
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'M':
+			nr_pageframes = strtoimax(optarg, NULL, 0);
+			break;
+		case 'X':
+			nr_swap_slots = strtoimax(optarg, NULL, 0);
+			break;
+		case 'Z':
+			lazy_fork = true;
+			break;
+		case 'T':
+			pt_levels = strtoimax(optarg, NULL, 0);
+			break;
+		case 'b':
+			pt_bits = strtoimax(optarg, NULL, 0);
+			break;
+		case 'O':
+			if (set_pt_format(optarg)) return EXIT_FAILURE;
+			break;
+		case 'R':
+			if (set_reclaim_policy(optarg)) return EXIT_FAILURE;
+			break;
+		case 'B':
+			swap_file = optarg;
+			break;
+		case 'c':
+			auto_compact = true;
+			break;
+		case 'H':
+			thp_threshold = strtoimax(optarg, NULL, 0);
+			break;
+		case 'Y':
+			thp_scan_interval = strtoimax(optarg, NULL, 0);
+			break;
+		case 'h':
+		default:
+			__print_usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (init_tlb(&dtlb, tlb_sets, tlb_ways, tlb_policy)) {
+		return EXIT_FAILURE;
+	}
+	if (stlb_ways && init_tlb(&stlb, stlb_sets, stlb_ways, stlb_policy)) {
+		return EXIT_FAILURE;
+	}
+	if (init_pwc()) {
+		return EXIT_FAILURE;
+	}
+	if (nr_swap_slots && reclaim_policy == RECLAIM_NONE) {
+		reclaim_policy = RECLAIM_CLOCK;
+	}
+	if (!nr_swap_slots) reclaim_policy = RECLAIM_NONE;
+
+	if (lazy_fork && pt_format == PT_HASHED) {
+		fprintf(stderr, "Lazy fork needs the radix page table\n");
+		return EXIT_FAILURE;
+	}
+
+	if ((thp_threshold || thp_scan_interval) && pt_format == PT_HASHED) {
+		fprintf(stderr, "Transparent huge pages need the radix page table\n");
+		return EXIT_FAILURE;
+	}
+	if ((thp_threshold || thp_scan_interval) && !__huge_tlb_supported()) {
+		return EXIT_FAILURE;
+	}
+	if (thp_threshold > pages_per_huge_page()) {
+		fprintf(stderr, "The THP threshold should be up to %lu pages\n",
+				pages_per_huge_page());
+		return EXIT_FAILURE;
+	}
+
+	/* The buffer is flushed in blocks, and at exit() */
+	if (output_block_kb) {
+		size_t size = (size_t)output_block_kb << 10;
+
+		if (setvbuf(stderr, malloc(size), _IOFBF, size)) {
+			fprintf(stderr, "Unable to buffer the output in %u KiB\n", output_block_kb);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (init_pagetable() || init_frames() || init_swap()) {
+		return EXIT_FAILURE;
+	}
+
+	if (generate) {
+		if (argv[optind]) {
+			fprintf(stderr, "Unable to generate the workload with the workload file\n");
+			return EXIT_FAILURE;
+		}
+		if (convert_path) {
+			if (generate_trace(&gen, &trace)) return EXIT_FAILURE;
+			if (save_trace(&trace, convert_path)) ret = EXIT_FAILURE;
+
+			unmap_trace(&trace);
+			return ret;
+		}
+		if (init_generator(&generator, &gen)) return EXIT_FAILURE;
+		text_input = 0;
+		verbose = false;
+	}
+
+	if (verbose && !argv[optind]) {
+		printf("***************************************************************************\n");
+		printf(" __      ____  __     _____ _                 _       _\n");
+		printf(" \\ \\    / /  \\/  |   / ____(_)               | |     | |\n");
+		printf("  \\ \\  / /| \\  / |  | (___  _ _ __ ___  _   _| | __ _| |_ ___  _ __ \n");
+		printf("   \\ \\/ / | |\\/| |   \\___ \\| | '_ ` _ \\| | | | |/ _` | __/ _ \\| '__|\n");
+		printf("    \\  /  | |  | |   ____) | | | | | | | |_| | | (_| | || (_) | |   \n");
+		printf("     \\/   |_|  |_|  |_____/|_|_| |_| |_|\\__,_|_|\\__,_|\\__\\___/|_|\n");
+		printf("\n");
+		printf("                                            >> SCE213 2021 Fall <<\n");
+		printf("\n");
+		printf("***************************************************************************\n");
+	}
+
+	if (argv[optind] && !convert_path) {
+		/* The file is read as text commands unless it is a binary trace */
+		text_input = map_trace(argv[optind], &trace);
+		if (text_input < 0) return EXIT_FAILURE;
+	}
+
+	if (argv[optind]) {
+		if (verbose) printf("Use file \"%s\" for input.\n", argv[optind]);
+
+		input = text_input ? fopen(argv[optind], "r") : NULL;
+		if (text_input && !input) {
+			fprintf(stderr, "No input file %s\n", argv[optind]);
+			return EXIT_FAILURE;
+		}
+		verbose = false;
+	} else if (text_input) {
+		if (verbose) printf("Use stdin for input.\n");
+	}
+
+	if (convert_path && text_input) {
+		__init_commands();
+		if (convert_trace(input, convert_path, __make_record)) ret = EXIT_FAILURE;
+
+		if (input != stdin) fclose(input);
+		return ret;
+	}
+
+	if (verbose) {
+		printf("Enter 'help' or '?' for help.\n\n");
+		printf(">> ");
+	}
+
+	if (text_input) {
+		__do_simulation(input);
+	} else if (generate) {
+		__replay_workload(&generator);
+		exit_generator(&generator);
+	} else {
+		__replay_trace(&trace);
+		unmap_trace(&trace);
+	}
+
+	if (batch) __show_batch_summary();
+
+	if (stats_json_path && __dump_stats_json(stats_json_path)) {
+		ret = EXIT_FAILURE;
+	}
+
+	exit_swap();
+
+	if (input && input != stdin) fclose(input);
+
+	return ret;
 }
@@ -17,32 +17,156 @@
 
 #include "types.h"
 
-/* The number of physical page frames of the system */
+/* The default number of physical page frames of the system */
 #define NR_PAGEFRAMES	128
 
-/* The number of PTEs in a page */
+/* The default number of PTEs in a page */
 #define PTES_PER_PAGE_SHIFT	4
 #define NR_PTES_PER_PAGE    (1 << PTES_PER_PAGE_SHIFT)
 
+/* The default number of page table levels */
+#define NR_PT_LEVELS	2
+
 #define RW_READ  0x01
 #define RW_WRITE 0x02
 
 /**
- * 2-level page table abstraction
+ * Multi-level page table abstraction
+ *
+ * A PTE is packed into a single 32-bit word. The low byte holds the flags,
+ * and the upper PTE_PFN_BITS bits hold the PFN, or the swap slot when the PTE
+ * is a swap entry.
+ *
+ *   31                        8 7   6   5   4   3   2   1   0
+ *  +---------------------------+---+---+---+---+---+---+---+---+
+ *  |      PFN / swap slot      |THP|HUG|SWP|DRT|ACC|COW| W | V |
+ *  +---------------------------+---+---+---+---+---+---+---+---+
  */
+#define PTE_VALID	0x01
+#define PTE_WRITABLE	0x02
+#define PTE_COW		0x04	/* Mapped for write; copy on write faults */
+#define PTE_ACCESSED	0x08	/* Set by MMU when the mapping is walked */
+#define PTE_DIRTY	0x10	/* Set by MMU when the page is written */
+#define PTE_SWAPPED	0x20	/* Not present, and the PFN holds the swap slot */
+#define PTE_HUGE	0x40	/* Maps a huge page; the PFN is the first frame */
+#define PTE_THP		0x80	/* The huge page is promoted from small pages, and
+				 * is split back when a part of it changes */
+
+#define PTE_FLAGS_MASK	0xff
+#define PTE_PFN_SHIFT	8
+#define PTE_PFN_BITS	24
+#define PTE_MAX_PFN	((1U << PTE_PFN_BITS) - 1)
+
 struct pte {
-	bool valid;
-	bool writable;
-	unsigned int pfn;
-	unsigned int private;	/* May use to backup something ;-) */
+	unsigned int val;
 };
 
+static inline bool pte_valid(struct pte *pte)
+{
+	return !!(pte->val & PTE_VALID);
+}
+
+static inline bool pte_writable(struct pte *pte)
+{
+	return !!(pte->val & PTE_WRITABLE);
+}
+
+static inline bool pte_cow(struct pte *pte)
+{
+	return !!(pte->val & PTE_COW);
+}
+
+static inline bool pte_accessed(struct pte *pte)
+{
+	return !!(pte->val & PTE_ACCESSED);
+}
+
+static inline bool pte_dirty(struct pte *pte)
+{
+	return !!(pte->val & PTE_DIRTY);
+}
+
+static inline bool pte_swapped(struct pte *pte)
+{
+	return !!(pte->val & PTE_SWAPPED);
+}
+
+static inline bool pte_huge(struct pte *pte)
+{
+	return !!(pte->val & PTE_HUGE);
+}
+
+static inline bool pte_thp(struct pte *pte)
+{
+	return !!(pte->val & PTE_THP);
+}
+
+static inline bool pte_none(struct pte *pte)
+{
+	return !(pte->val & (PTE_VALID | PTE_SWAPPED));
+}
+
+static inline unsigned int pte_pfn(struct pte *pte)
+{
+	return pte->val >> PTE_PFN_SHIFT;
+}
+
+static inline unsigned int pte_flags(struct pte *pte)
+{
+	return pte->val & PTE_FLAGS_MASK;
+}
+
+static inline void set_pte(struct pte *pte, unsigned int pfn, unsigned int flags)
+{
+	pte->val = (pfn << PTE_PFN_SHIFT) | (flags & PTE_FLAGS_MASK);
+}
+
+static inline void pte_set_flags(struct pte *pte, unsigned int flags)
+{
+	pte->val |= flags;
+}
+
+static inline void pte_clear_flags(struct pte *pte, unsigned int flags)
+{
+	pte->val &= ~flags;
+}
+
+static inline void clear_pte(struct pte *pte)
+{
+	pte->val = 0;
+}
+
+/**
+ * The page table has @pt_levels levels of nodes with (1 << @pt_bits) entries
+ * each (see pgtable.h). The last level nodes are page directories holding
+ * PTEs. The upper level nodes hold the entries pointing to the nodes of the
+ * next level, along with the bookkeeping of the next level nodes so that the
+ * page directories fit in cache lines. An entry in the last upper level may
+ * map a huge page of (1 << @pt_bits) contiguous page frames by itself
+ * instead of pointing to a page directory.
+ */
 struct pte_directory {
-	struct pte ptes[NR_PTES_PER_PAGE];
+	struct pte ptes[0];
+};
+
+struct pt_entry {
+	void *next;		/* struct pt_node, or struct pte_directory at the last */
+	union {
+		unsigned int nr_used;	/* The number of valid or swapped entries in @next */
+		struct pte pte;		/* The huge page mapping if @huge */
+	};
+	bool shared;		/* @next is a page directory shared by lazy fork.
+				 * Writes through the directory fault to copy it */
+	bool huge;		/* Maps a huge page with @pte instead of @next */
+};
+
+struct pt_node {
+	struct pt_entry entries[0];
 };
 
 struct pagetable {
-	struct pte_directory *outer_ptes[NR_PTES_PER_PAGE];
+	struct pt_node *root;
+	unsigned int id;	/* Tags the entries in the hashed page table */
 };
 
 
@@ -54,14 +178,28 @@ struct process {
 
 	struct pagetable pagetable;
 
+	unsigned int asid;		/* Address space identifier tagging the TLB */
+	unsigned long asid_generation;	/* Generation @asid is assigned at */
+
+	/* Transparent huge page statistics */
+	unsigned long nr_thp_promotions;
+	unsigned long nr_thp_demotions;
+	unsigned long nr_huge_tlb_saved;	/* TLB misses saved by huge pages */
+
 	struct list_head list;  /* List head to chain processes on the system */
 };
 
 
 struct tlb_entry {
 	bool valid;
-	unsigned int vpn;
+	unsigned int asid;
+	unsigned long vpn;
 	unsigned int pfn;
+	bool writable;		/* Translates writes as well as reads */
+	bool huge;		/* Maps the huge page starting at @vpn and @pfn */
+	unsigned long touched;	/* Pages of the huge page translated so far, one bit each */
+
+	struct hlist_node hnode;	/* Chain in the VPN-indexed TLB hash */
 };
 
 #define NR_TLB_ENTRIES	(1 << (PTES_PER_PAGE_SHIFT * 2))